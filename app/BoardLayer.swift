@@ -17,9 +17,9 @@ class BoardLayer: CALayer {
       }
       self.board = .init(
         position: status.game.position,
-        blackHand: .init(status.game.handBlack),
-        whiteHand: .init(status.game.handWhite),
-        move: status.game.moves.last,
+        blackHand: .init(status.game.handBlack.pieces()),
+        whiteHand: .init(status.game.handWhite.pieces()),
+        move: status.game.moves.last.map { sci.MoveFromPackedMove($0) },
         showArrow: status.waitingMove)
     }
   }
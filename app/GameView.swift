@@ -259,17 +259,15 @@ class GameView: UIView {
     var lines: [String] = []
     var last: sci.Square? = nil
     for i in 0..<status.game.moves.size() {
-      let move = status.game.moves[i]
+      let move = sci.MoveFromPackedMove(status.game.moves[i])
       if let last {
-        let str = sci.StringFromMove(move, last)
-        if let line = sci.Utility.CFStringFromU8String(str) {
+        if let line = sci.Utility.CFStringFromMove(move, last) {
           lines.append(line.takeRetainedValue() as String)
         } else {
           lines.append("エラー: 指し手を文字列に変換できませんでした")
         }
       } else {
-        let str = sci.StringFromMove(move)
-        if let line = sci.Utility.CFStringFromU8String(str) {
+        if let line = sci.Utility.CFStringFromMove(move) {
           lines.append(line.takeRetainedValue() as String)
         } else {
           lines.append("エラー: 指し手を文字列に変換できませんでした")
@@ -334,8 +332,8 @@ class GameView: UIView {
           0
         }
       for i in start..<status.game.moves.size() {
-        let mv = status.game.moves[i]
-        self.reader?.play(move: mv, first: status.game.first, last: i > 0 ? status.game.moves[i - 1] : nil)
+        let mv = sci.MoveFromPackedMove(status.game.moves[i])
+        self.reader?.play(move: mv, first: status.game.first, last: i > 0 ? sci.MoveFromPackedMove(status.game.moves[i - 1]) : nil)
         self.moveIndex = i
       }
     }
@@ -399,8 +397,8 @@ class GameView: UIView {
       if status.wrongMove && !status.aborted {
         if self.wrongMoveLastNotified == nil || Date.now.timeIntervalSince(self.wrongMoveLastNotified!) > self.kWrongMoveNotificationInterval {
           self.wrongMoveLastNotified = Date.now
-          if let mv = status.game.moves.last {
-            let last = status.game.moves.dropLast().last
+          if let mv = status.game.moves.last.map({ sci.MoveFromPackedMove($0) }) {
+            let last = status.game.moves.dropLast().last.map { sci.MoveFromPackedMove($0) }
             self.reader?.playWrongMoveWarning(expected: mv, last: last)
           }
         }
@@ -525,7 +523,7 @@ class GameView: UIView {
     var last: sci.Square? = nil
     for i in 0..<status.game.moves.size() {
       var line = "\(i + 1) "
-      let mv = status.game.moves[i]
+      let mv = sci.MoveFromPackedMove(status.game.moves[i])
       if let last, last == mv.to {
         line += "同"
       } else {
@@ -5,13 +5,25 @@
 #include <hwm/task/task_queue.hpp>
 #include <opencv2/core.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <random>
 #include <set>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 
 #if defined(__APPLE__)
@@ -46,7 +58,7 @@ enum class Color : PieceUnderlyingType {
   White = 0b0100000, // 後手(上手)
 };
 
-inline Color OpponentColor(Color color) {
+constexpr Color OpponentColor(Color color) {
   if (color == Color::Black) {
     return Color::White;
   } else {
@@ -54,45 +66,50 @@ inline Color OpponentColor(Color color) {
   }
 }
 
+// 先手を 0, 後手を 1 とする配列の添字.
+constexpr int ColorIndex(Color color) {
+  return color == Color::Black ? 0 : 1;
+}
+
 using Piece = PieceUnderlyingType; // PieceType | PieceStatus | Color;
 
-inline Piece MakePiece(Color color, PieceType type, PieceStatus status = PieceStatus::Default) {
+constexpr Piece MakePiece(Color color, PieceType type, PieceStatus status = PieceStatus::Default) {
   return static_cast<PieceUnderlyingType>(color) | static_cast<PieceUnderlyingType>(type) | static_cast<PieceUnderlyingType>(status);
 }
 
-inline Color ColorFromPiece(Piece p) {
+constexpr Color ColorFromPiece(Piece p) {
   return static_cast<Color>(p & 0b1100000);
 }
 
-inline PieceUnderlyingType RemoveColorFromPiece(Piece p) {
+constexpr PieceUnderlyingType RemoveColorFromPiece(Piece p) {
   return p & 0b11111;
 }
 
-inline Piece RemoveStatusFromPiece(Piece p) {
+constexpr Piece RemoveStatusFromPiece(Piece p) {
   return p & 0b1101111;
 }
 
-inline PieceType PieceTypeFromPiece(Piece p) {
+constexpr PieceType PieceTypeFromPiece(Piece p) {
   return static_cast<PieceType>(p & 0b1111);
 }
 
-inline bool IsPromotedPiece(Piece p) {
+constexpr bool IsPromotedPiece(Piece p) {
   return (p & 0b10000) == 0b10000;
 }
 
-inline Piece Promote(Piece p) {
+constexpr Piece Promote(Piece p) {
   return p | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
 }
 
-inline Piece Unpromote(Piece p) {
+constexpr Piece Unpromote(Piece p) {
   return p & ~static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
 }
 
-inline bool IsPromotablePieceType(PieceType t) {
+constexpr bool IsPromotablePieceType(PieceType t) {
   return (t != PieceType::King) && (t != PieceType::Gold);
 }
 
-inline bool CanPromote(Piece p) {
+constexpr bool CanPromote(Piece p) {
   if (IsPromotedPiece(p)) {
     return false;
   }
@@ -100,7 +117,8 @@ inline bool CanPromote(Piece p) {
   return IsPromotablePieceType(type);
 }
 
-inline std::u8string ShortStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
+// 1 文字の駒の名前. 成銀は "全" のようになる.
+constexpr std::u8string_view ShortStringViewFromPieceTypeAndStatus(PieceUnderlyingType p) {
   auto i = RemoveColorFromPiece(p);
   switch (i) {
   case static_cast<PieceUnderlyingType>(PieceType::Empty):
@@ -137,68 +155,173 @@ inline std::u8string ShortStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
   return u8"？";
 }
 
-inline std::optional<PieceUnderlyingType> TrimPieceTypeAndStatusPartFromString(std::u8string &inout) {
-  using namespace std;
-  if (inout.starts_with(u8"玉")) {
-    inout = inout.substr(u8string(u8"玉").size());
-    return static_cast<PieceUnderlyingType>(PieceType::King);
-  } else if (inout.starts_with(u8"飛")) {
-    inout = inout.substr(u8string(u8"飛").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Rook);
-  } else if (inout.starts_with(u8"角")) {
-    inout = inout.substr(u8string(u8"角").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Bishop);
-  } else if (inout.starts_with(u8"金")) {
-    inout = inout.substr(u8string(u8"金").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Gold);
-  } else if (inout.starts_with(u8"銀")) {
-    inout = inout.substr(u8string(u8"銀").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Silver);
-  } else if (inout.starts_with(u8"桂")) {
-    inout = inout.substr(u8string(u8"桂").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Knight);
-  } else if (inout.starts_with(u8"香")) {
-    inout = inout.substr(u8string(u8"香").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Lance);
-  } else if (inout.starts_with(u8"歩")) {
-    inout = inout.substr(u8string(u8"歩").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Pawn);
-  } else if (inout.starts_with(u8"龍")) {
-    inout = inout.substr(u8string(u8"龍").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Rook) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"馬")) {
-    inout = inout.substr(u8string(u8"馬").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Bishop) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"成銀")) {
-    inout = inout.substr(u8string(u8"成銀").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"全")) {
-    inout = inout.substr(u8string(u8"全").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"成桂")) {
-    inout = inout.substr(u8string(u8"成桂").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Knight) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"圭")) {
-    inout = inout.substr(u8string(u8"圭").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Knight) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"成香")) {
-    inout = inout.substr(u8string(u8"成香").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Lance) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"杏")) {
-    inout = inout.substr(u8string(u8"杏").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Lance) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"と金")) {
-    inout = inout.substr(u8string(u8"と金").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else if (inout.starts_with(u8"と")) {
-    inout = inout.substr(u8string(u8"と").size());
-    return static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
-  } else {
-    return std::nullopt;
+inline std::u8string ShortStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
+  return std::u8string(ShortStringViewFromPieceTypeAndStatus(p));
+}
+
+// 棋譜の表記に使う文字の種類
+enum class NotationCharType : uint8_t {
+  None,
+  Number,   // "7", "７", "七". value は 1 から 9
+  Piece,    // "歩", "と" など 1 文字の駒. value は駒の種類と成り
+  Promoted, // "成銀" などの "成"
+};
+
+struct NotationChar {
+  char32_t code = 0;
+  NotationCharType type = NotationCharType::None;
+  PieceUnderlyingType value = 0;
+};
+
+inline constexpr NotationChar kNotationChars[] = {
+    {U'1', NotationCharType::Number, 1},
+    {U'2', NotationCharType::Number, 2},
+    {U'3', NotationCharType::Number, 3},
+    {U'4', NotationCharType::Number, 4},
+    {U'5', NotationCharType::Number, 5},
+    {U'6', NotationCharType::Number, 6},
+    {U'7', NotationCharType::Number, 7},
+    {U'8', NotationCharType::Number, 8},
+    {U'9', NotationCharType::Number, 9},
+    {U'１', NotationCharType::Number, 1},
+    {U'２', NotationCharType::Number, 2},
+    {U'３', NotationCharType::Number, 3},
+    {U'４', NotationCharType::Number, 4},
+    {U'５', NotationCharType::Number, 5},
+    {U'６', NotationCharType::Number, 6},
+    {U'７', NotationCharType::Number, 7},
+    {U'８', NotationCharType::Number, 8},
+    {U'９', NotationCharType::Number, 9},
+    {U'一', NotationCharType::Number, 1},
+    {U'二', NotationCharType::Number, 2},
+    {U'三', NotationCharType::Number, 3},
+    {U'四', NotationCharType::Number, 4},
+    {U'五', NotationCharType::Number, 5},
+    {U'六', NotationCharType::Number, 6},
+    {U'七', NotationCharType::Number, 7},
+    {U'八', NotationCharType::Number, 8},
+    {U'九', NotationCharType::Number, 9},
+    {U'玉', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::King)},
+    {U'王', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::King)},
+    {U'飛', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Rook)},
+    {U'角', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Bishop)},
+    {U'金', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Gold)},
+    {U'銀', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Silver)},
+    {U'桂', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Knight)},
+    {U'香', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Lance)},
+    {U'歩', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Pawn)},
+    {U'龍', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Rook) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'竜', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Rook) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'馬', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Bishop) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'全', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'圭', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Knight) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'杏', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Lance) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'と', NotationCharType::Piece, static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+    {U'成', NotationCharType::Promoted, 0},
+};
+
+// kNotationChars の完全ハッシュ. 衝突しない乗数をコンパイル時に探す.
+inline constexpr uint32_t kNotationHashBits = 7;
+
+constexpr uint32_t NotationHash(char32_t code, uint32_t multiplier) {
+  return (uint32_t(code) * multiplier) >> (32 - kNotationHashBits);
+}
+
+inline constexpr uint32_t kNotationHashMultiplier = [] {
+  for (uint32_t m = 0x9e3779b1;; m += 2) {
+    bool used[1 << kNotationHashBits] = {};
+    bool ok = true;
+    for (auto const &c : kNotationChars) {
+      uint32_t h = NotationHash(c.code, m);
+      if (used[h]) {
+        ok = false;
+        break;
+      }
+      used[h] = true;
+    }
+    if (ok) {
+      return m;
+    }
+  }
+}();
+
+inline constexpr auto kNotationTable = [] {
+  std::array<NotationChar, 1 << kNotationHashBits> t{};
+  for (auto const &c : kNotationChars) {
+    t[NotationHash(c.code, kNotationHashMultiplier)] = c;
   }
+  return t;
+}();
+
+// s の offset バイト目から始まる UTF-8 の 1 文字. length にそのバイト数を返す. 文字が無いか不正なバイト列の場合は 0 を返す.
+constexpr char32_t DecodeUtf8(std::u8string_view s, size_t offset, size_t &length) {
+  length = 0;
+  if (offset >= s.size()) {
+    return 0;
+  }
+  uint8_t c = s[offset];
+  if (c < 0x80) {
+    length = 1;
+    return c;
+  } else if ((c & 0xe0) == 0xc0 && offset + 1 < s.size()) {
+    length = 2;
+    return (char32_t(c & 0x1f) << 6) | (s[offset + 1] & 0x3f);
+  } else if ((c & 0xf0) == 0xe0 && offset + 2 < s.size()) {
+    length = 3;
+    return (char32_t(c & 0x0f) << 12) | (char32_t(s[offset + 1] & 0x3f) << 6) | (s[offset + 2] & 0x3f);
+  }
+  return 0;
 }
 
-inline std::u8string LongStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
+// s の offset バイト目の文字の種類. length にそのバイト数を返す.
+constexpr NotationChar LookupNotationChar(std::u8string_view s, size_t offset, size_t &length) {
+  char32_t code = DecodeUtf8(s, offset, length);
+  NotationChar const &c = kNotationTable[NotationHash(code, kNotationHashMultiplier)];
+  if (code == 0 || c.code != code) {
+    return NotationChar();
+  }
+  return c;
+}
+
+static_assert([] {
+  size_t length = 0;
+  return LookupNotationChar(u8"七", 0, length).value == 7 && length == 3 && LookupNotationChar(u8"成銀", 0, length).type == NotationCharType::Promoted && LookupNotationChar(u8"x", 0, length).type == NotationCharType::None;
+}());
+
+// s の offset バイト目から "歩", "成銀" のような駒の表記を読み取る. 読み取れた場合は offset を進める.
+constexpr std::optional<PieceUnderlyingType> ParsePieceTypeAndStatus(std::u8string_view s, size_t &offset) {
+  size_t length = 0;
+  NotationChar c = LookupNotationChar(s, offset, length);
+  if (c.type == NotationCharType::Piece) {
+    offset += length;
+    if (c.value == (static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted))) {
+      // "と金"
+      size_t next = 0;
+      if (DecodeUtf8(s, offset, next) == U'金') {
+        offset += next;
+      }
+    }
+    return c.value;
+  } else if (c.type == NotationCharType::Promoted) {
+    size_t next = 0;
+    NotationChar p = LookupNotationChar(s, offset + length, next);
+    if (p.type == NotationCharType::Piece && (p.value == static_cast<PieceUnderlyingType>(PieceType::Silver) || p.value == static_cast<PieceUnderlyingType>(PieceType::Knight) || p.value == static_cast<PieceUnderlyingType>(PieceType::Lance))) {
+      offset += length + next;
+      return p.value | static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
+    }
+  }
+  return std::nullopt;
+}
+
+inline std::optional<PieceUnderlyingType> TrimPieceTypeAndStatusPartFromString(std::u8string &inout) {
+  size_t offset = 0;
+  auto ret = ParsePieceTypeAndStatus(inout, offset);
+  inout.erase(0, offset);
+  return ret;
+}
+
+// 棋譜に書く駒の名前. 成銀は "成銀" のようになる.
+constexpr std::u8string_view LongStringViewFromPieceTypeAndStatus(PieceUnderlyingType p) {
   auto i = RemoveColorFromPiece(p);
   switch (i) {
   case static_cast<PieceUnderlyingType>(PieceType::Empty):
@@ -235,17 +358,569 @@ inline std::u8string LongStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
   return u8"？";
 }
 
+inline std::u8string LongStringFromPieceTypeAndStatus(PieceUnderlyingType p) {
+  return std::u8string(LongStringViewFromPieceTypeAndStatus(p));
+}
+
+// 81 マスを 1 マス 1 bit で表す. マスの添字は x * 9 + y (x: 筋, 左(９筋)が 0. y: 段, 上(一段)が 0) で, Position#pieces のメモリ上の並びと同じ.
+// lo に x = 0~6 の 63 マス, hi に x = 7~8 の 18 マスを格納する.
+struct Bitboard {
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+
+  static constexpr int kLoSquares = 63;
+  static constexpr uint64_t kLoMask = (uint64_t(1) << 63) - 1;
+  static constexpr uint64_t kHiMask = (uint64_t(1) << 18) - 1;
+
+  constexpr Bitboard() = default;
+  constexpr Bitboard(uint64_t lo, uint64_t hi) : lo(lo), hi(hi) {}
+
+  static constexpr Bitboard FromIndex(int index) {
+    if (index < kLoSquares) {
+      return Bitboard(uint64_t(1) << index, 0);
+    } else {
+      return Bitboard(0, uint64_t(1) << (index - kLoSquares));
+    }
+  }
+
+  static constexpr Bitboard All() {
+    return Bitboard(kLoMask, kHiMask);
+  }
+
+  constexpr bool test(int index) const {
+    if (index < kLoSquares) {
+      return (lo >> index) & 1;
+    } else {
+      return (hi >> (index - kLoSquares)) & 1;
+    }
+  }
+
+  constexpr void set(int index) {
+    *this |= FromIndex(index);
+  }
+
+  constexpr void reset(int index) {
+    *this = andNot(FromIndex(index));
+  }
+
+  constexpr bool empty() const {
+    return lo == 0 && hi == 0;
+  }
+
+  constexpr explicit operator bool() const {
+    return !empty();
+  }
+
+  constexpr int count() const {
+    return std::popcount(lo) + std::popcount(hi);
+  }
+
+  // 最も添字の小さいマス. 空の場合は呼んではいけない.
+  constexpr int lsb() const {
+    if (lo != 0) {
+      return std::countr_zero(lo);
+    } else {
+      return kLoSquares + std::countr_zero(hi);
+    }
+  }
+
+  // 最も添字の大きいマス. 空の場合は呼んではいけない.
+  constexpr int msb() const {
+    if (hi != 0) {
+      return kLoSquares + 63 - std::countl_zero(hi);
+    } else {
+      return 63 - std::countl_zero(lo);
+    }
+  }
+
+  // 最も添字の小さいマスを取り除き, その添字を返す. 空の場合は呼んではいけない.
+  constexpr int pop() {
+    if (lo != 0) {
+      int index = std::countr_zero(lo);
+      lo &= lo - 1;
+      return index;
+    } else {
+      int index = kLoSquares + std::countr_zero(hi);
+      hi &= hi - 1;
+      return index;
+    }
+  }
+
+  constexpr Bitboard andNot(Bitboard const &other) const {
+    return Bitboard(lo & ~other.lo, hi & ~other.hi);
+  }
+
+  constexpr Bitboard operator~() const {
+    return Bitboard(~lo & kLoMask, ~hi & kHiMask);
+  }
+
+  constexpr Bitboard operator|(Bitboard const &other) const {
+    return Bitboard(lo | other.lo, hi | other.hi);
+  }
+
+  constexpr Bitboard operator&(Bitboard const &other) const {
+    return Bitboard(lo & other.lo, hi & other.hi);
+  }
+
+  constexpr Bitboard operator^(Bitboard const &other) const {
+    return Bitboard(lo ^ other.lo, hi ^ other.hi);
+  }
+
+  constexpr Bitboard &operator|=(Bitboard const &other) {
+    lo |= other.lo;
+    hi |= other.hi;
+    return *this;
+  }
+
+  constexpr Bitboard &operator&=(Bitboard const &other) {
+    lo &= other.lo;
+    hi &= other.hi;
+    return *this;
+  }
+
+  constexpr Bitboard &operator^=(Bitboard const &other) {
+    lo ^= other.lo;
+    hi ^= other.hi;
+    return *this;
+  }
+
+  constexpr bool operator==(Bitboard const &other) const {
+    return lo == other.lo && hi == other.hi;
+  }
+};
+
+// 走り駒の利きの方向. 0~3 はマスの添字が増える方向 (下, 右上, 右, 右下), 4~7 は減る方向 (上, 左下, 左, 左上).
+// d と (d + 4) % 8 は逆向き.
+inline constexpr int kDirectionDx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+inline constexpr int kDirectionDy[8] = {1, -1, 0, 1, -1, 1, 0, -1};
+
+// 先手の駒が 1 マスだけ動ける方向 (kDirectionDx, kDirectionDy の添字) のビット集合. 桂の動きは含まない.
+constexpr uint8_t StepDirections(PieceUnderlyingType typeAndStatus) {
+  constexpr PieceUnderlyingType promoted = static_cast<PieceUnderlyingType>(PieceStatus::Promoted);
+  switch (typeAndStatus) {
+  case static_cast<PieceUnderlyingType>(PieceType::King):
+    return 0b11111111;
+  case static_cast<PieceUnderlyingType>(PieceType::Gold):
+  case static_cast<PieceUnderlyingType>(PieceType::Silver) | promoted:
+  case static_cast<PieceUnderlyingType>(PieceType::Knight) | promoted:
+  case static_cast<PieceUnderlyingType>(PieceType::Lance) | promoted:
+  case static_cast<PieceUnderlyingType>(PieceType::Pawn) | promoted:
+    return 0b11010111;
+  case static_cast<PieceUnderlyingType>(PieceType::Silver):
+    return 0b10111010;
+  case static_cast<PieceUnderlyingType>(PieceType::Pawn):
+    return 0b00010000;
+  case static_cast<PieceUnderlyingType>(PieceType::Rook) | promoted:
+    return 0b10101010;
+  case static_cast<PieceUnderlyingType>(PieceType::Bishop) | promoted:
+    return 0b01010101;
+  default:
+    return 0;
+  }
+}
+
+// 駒 piece が走って利く方向のビット集合.
+constexpr uint8_t SlidingDirections(Piece piece) {
+  switch (PieceTypeFromPiece(piece)) {
+  case PieceType::Rook:
+    return 0b01010101;
+  case PieceType::Bishop:
+    return 0b10101010;
+  case PieceType::Lance:
+    if (IsPromotedPiece(piece)) {
+      return 0;
+    }
+    return ColorFromPiece(piece) == Color::Black ? 0b00010000 : 0b00000001;
+  default:
+    return 0;
+  }
+}
+
+// 利きの表. コンパイル時に計算する.
+struct AttackTable {
+  // 1 マスだけ動ける方向への利き. [ColorIndex][RemoveColorFromPiece][マスの添字]
+  Bitboard step[2][32][81];
+  // 盤の端までの方向 d のマス. [d][マスの添字]
+  Bitboard ray[8][81];
+  Bitboard file[9];
+  Bitboard rank[9];
+  // a から見た b の方向. 縦横斜めのいずれにも並んでいない場合は -1. [a][b]
+  int8_t direction[81][81];
+};
+
+constexpr AttackTable MakeAttackTable() {
+  // 全ての要素に明示的に代入しておく. 値初期化されたままの要素は, GCC 12 では定数式の中で読めない.
+  AttackTable t{};
+  // [dy + 1][dx + 1] の向きの方向
+  constexpr int8_t directionFromSign[3][3] = {{7, 4, 1}, {6, -1, 2}, {5, 0, 3}};
+  for (int x = 0; x < 9; x++) {
+    for (int y = 0; y < 9; y++) {
+      int index = x * 9 + y;
+      t.file[x].set(index);
+      t.rank[y].set(index);
+      for (int d = 0; d < 8; d++) {
+        t.ray[d][index] = Bitboard();
+        for (int i = 1; i < 9; i++) {
+          int tx = x + kDirectionDx[d] * i;
+          int ty = y + kDirectionDy[d] * i;
+          if (tx < 0 || 9 <= tx || ty < 0 || 9 <= ty) {
+            break;
+          }
+          t.ray[d][index].set(tx * 9 + ty);
+        }
+      }
+      for (int b = 0; b < 81; b++) {
+        int dx = b / 9 - x;
+        int dy = b % 9 - y;
+        if (b == index || (dx != 0 && dy != 0 && dx != dy && dx != -dy)) {
+          t.direction[index][b] = -1;
+        } else {
+          t.direction[index][b] = directionFromSign[(dy > 0) - (dy < 0) + 1][(dx > 0) - (dx < 0) + 1];
+        }
+      }
+      for (int c = 0; c < 2; c++) {
+        // 後手の駒は先手の駒の動きを上下反転させたもの
+        int sign = c == 0 ? 1 : -1;
+        for (PieceUnderlyingType p = 0; p < 32; p++) {
+          uint8_t directions = StepDirections(p);
+          t.step[c][p][index] = Bitboard();
+          for (int d = 0; directions != 0 && d < 8; d++) {
+            int tx = x + kDirectionDx[d];
+            int ty = y + kDirectionDy[d] * sign;
+            if (((directions >> d) & 1) && 0 <= tx && tx < 9 && 0 <= ty && ty < 9) {
+              t.step[c][p][index].set(tx * 9 + ty);
+            }
+          }
+          if (p == static_cast<PieceUnderlyingType>(PieceType::Knight)) {
+            int ty = y - 2 * sign;
+            for (int tx : {x - 1, x + 1}) {
+              if (0 <= tx && tx < 9 && 0 <= ty && ty < 9) {
+                t.step[c][p][index].set(tx * 9 + ty);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return t;
+}
+
+inline constexpr AttackTable kAttackTable = MakeAttackTable();
+
+// x 筋の全マス.
+constexpr Bitboard FileBitboard(int x) {
+  return kAttackTable.file[x];
+}
+
+// y 段の全マス.
+constexpr Bitboard RankBitboard(int y) {
+  return kAttackTable.rank[y];
+}
+
+// 駒 piece が index のマスに居る時に, 1 マスだけ動ける方向への利き. 飛・角・香の走る利きは含まない.
+constexpr Bitboard StepAttacks(Piece piece, int index) {
+  return kAttackTable.step[ColorIndex(ColorFromPiece(piece))][RemoveColorFromPiece(piece)][index];
+}
+
+// index のマスから方向 d に走る利き. occupied は盤上の駒の有無で, 最初にぶつかる駒のマスまでを含む.
+constexpr Bitboard SlidingAttacks(int d, int index, Bitboard const &occupied) {
+  Bitboard ray = kAttackTable.ray[d][index];
+  Bitboard blockers = ray & occupied;
+  if (blockers) {
+    int b = d < 4 ? blockers.lsb() : blockers.msb();
+    ray ^= kAttackTable.ray[d][b];
+  }
+  return ray;
+}
+
+// 駒 piece が index のマスに居る時の利き. occupied は盤上の駒の有無. 利きの先に居る駒の色は問わない.
+constexpr Bitboard Attacks(Piece piece, int index, Bitboard const &occupied) {
+  Bitboard ret = StepAttacks(piece, index);
+  uint8_t directions = SlidingDirections(piece);
+  for (int d = 0; d < 8; d++) {
+    if ((directions >> d) & 1) {
+      ret |= SlidingAttacks(d, index, occupied);
+    }
+  }
+  return ret;
+}
+
+// a と b が縦横斜めいずれかで一直線に並んでいる時, a と b の間のマス (a, b は含まない). 並んでいない場合は空.
+constexpr Bitboard BetweenBitboard(int a, int b) {
+  int d = kAttackTable.direction[a][b];
+  if (d < 0) {
+    return Bitboard();
+  }
+  Bitboard ret = kAttackTable.ray[d][a] ^ kAttackTable.ray[d][b];
+  ret.reset(b);
+  return ret;
+}
+
+// a と b が縦横斜めいずれかで一直線に並んでいる時, a と b を通る直線上の全マス (a, b を含む). 並んでいない場合は空.
+constexpr Bitboard LineBitboard(int a, int b) {
+  int d = kAttackTable.direction[a][b];
+  if (d < 0) {
+    return Bitboard();
+  }
+  Bitboard ret = kAttackTable.ray[d][a] | kAttackTable.ray[(d + 4) % 8][a];
+  ret.set(a);
+  return ret;
+}
+
+// 駒 piece が from のマスに居る時, to のマスに利いているかどうか. occupied は盤上の駒の有無.
+constexpr bool AttacksSquare(Piece piece, int from, int to, Bitboard const &occupied) {
+  if (StepAttacks(piece, from).test(to)) {
+    return true;
+  }
+  int d = kAttackTable.direction[from][to];
+  return d >= 0 && ((SlidingDirections(piece) >> d) & 1) && !(BetweenBitboard(from, to) & occupied);
+}
+
+// ５五の先手の桂は４三と６三に利く
+static_assert(AttacksSquare(MakePiece(Color::Black, PieceType::Knight), 4 * 9 + 4, 5 * 9 + 2, Bitboard()));
+static_assert(!AttacksSquare(MakePiece(Color::Black, PieceType::Knight), 4 * 9 + 4, 4 * 9 + 2, Bitboard()));
+// ９九の先手の香は９一に利くが, ９五に駒があると利かない. 後手の香は利かない.
+static_assert(AttacksSquare(MakePiece(Color::Black, PieceType::Lance), 8, 0, Bitboard()));
+static_assert(!AttacksSquare(MakePiece(Color::White, PieceType::Lance), 8, 0, Bitboard()));
+static_assert(!AttacksSquare(MakePiece(Color::Black, PieceType::Lance), 8, 0, Bitboard::FromIndex(4)));
+
+// 局面のハッシュ値 (Zobrist ハッシュ) に使う乱数表.
+struct ZobristTable {
+  // 盤上の駒. [ColorIndex][RemoveColorFromPiece][マスの添字]
+  uint64_t piece[2][32][81];
+  // 持ち駒. 持ち駒を n 枚持っている時は [ColorIndex][PieceType][1] から [n] までを全て xor する.
+  uint64_t hand[2][9][19];
+  // 後手番
+  uint64_t white;
+};
+
+constexpr ZobristTable MakeZobristTable() {
+  ZobristTable t{};
+  uint64_t state = 0x5c0b1c4a3e5a7d21ULL;
+  auto next = [&state]() {
+    // splitmix64
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  for (int c = 0; c < 2; c++) {
+    for (int p = 0; p < 32; p++) {
+      for (int i = 0; i < 81; i++) {
+        t.piece[c][p][i] = next();
+      }
+    }
+    for (int p = 0; p < 9; p++) {
+      for (int n = 0; n < 19; n++) {
+        t.hand[c][p][n] = next();
+      }
+    }
+  }
+  t.white = next();
+  return t;
+}
+
+inline constexpr ZobristTable kZobrist = MakeZobristTable();
+
+constexpr uint64_t ZobristPiece(Piece p, int index) {
+  return kZobrist.piece[ColorIndex(ColorFromPiece(p))][RemoveColorFromPiece(p)][index];
+}
+
+// 手番 color の持ち駒 type の枚数が count - 1 枚から count 枚に増えた (あるいはその逆) 時のハッシュ値の変化量.
+constexpr uint64_t ZobristHand(Color color, PieceType type, size_t count) {
+  return kZobrist.hand[ColorIndex(color)][static_cast<PieceUnderlyingType>(type)][count];
+}
+
+// 持ち駒. 駒の種類ごとの枚数を 1 つの整数に詰めて持つ.
+// 各枚数の上位には 1bit ずつ空きを設けてあり, 種類ごとの枚数の大小比較をビット演算で行える.
+class Hand {
+public:
+  // 持ち駒にできる駒の種類
+  static constexpr PieceType kTypes[7] = {PieceType::Rook, PieceType::Bishop, PieceType::Gold, PieceType::Silver, PieceType::Knight, PieceType::Lance, PieceType::Pawn};
+
+  constexpr Hand() = default;
+
+  constexpr uint32_t count(PieceType type) const {
+    auto i = static_cast<PieceUnderlyingType>(type);
+    return (value >> kShift[i]) & kMask[i];
+  }
+
+  constexpr bool contains(PieceType type) const {
+    return count(type) > 0;
+  }
+
+  constexpr void add(PieceType type) {
+    value += uint32_t(1) << kShift[static_cast<PieceUnderlyingType>(type)];
+  }
+
+  // type を 1 枚減らす. type を持っていること.
+  constexpr void remove(PieceType type) {
+    value -= uint32_t(1) << kShift[static_cast<PieceUnderlyingType>(type)];
+  }
+
+  constexpr bool empty() const {
+    return value == 0;
+  }
+
+  // 持ち駒の総数
+  constexpr uint32_t size() const {
+    uint32_t ret = 0;
+    for (PieceType type : kTypes) {
+      ret += count(type);
+    }
+    return ret;
+  }
+
+  // 全ての種類について other 以上の枚数を持っているかどうか.
+  constexpr bool covers(Hand other) const {
+    return ((value - other.value) & kGuard) == 0;
+  }
+
+  // 駒を 1 枚ずつ並べたもの. Swift から参照する用.
+  std::vector<PieceType> pieces() const {
+    std::vector<PieceType> ret;
+    for (PieceType type : kTypes) {
+      for (uint32_t i = 0; i < count(type); i++) {
+        ret.push_back(type);
+      }
+    }
+    return ret;
+  }
+
+  constexpr bool operator==(Hand const &other) const {
+    return value == other.value;
+  }
+
+private:
+  // [PieceType]. 歩 5bit, 香・桂・銀・金 3bit, 角・飛 2bit.
+  static constexpr uint32_t kShift[9] = {0, 0, 25, 22, 18, 14, 10, 6, 0};
+  static constexpr uint32_t kMask[9] = {0, 0, 0x3, 0x3, 0x7, 0x7, 0x7, 0x7, 0x1f};
+  // 各枚数の 1 つ上のビット
+  static constexpr uint32_t kGuard = (1u << 27) | (1u << 24) | (1u << 21) | (1u << 17) | (1u << 13) | (1u << 9) | (1u << 5);
+
+  uint32_t value = 0;
+};
+
 struct Move;
 
+// 書き換える前に呼ぶ. ptr の指す値を他と共有していれば複製して, 書き換えても他に影響しないようにする.
+template <class T>
+T &Unshare(std::shared_ptr<T> &ptr) {
+  if (ptr.use_count() > 1) {
+    ptr = std::make_shared<T>(*ptr);
+  } else {
+    // 他のスレッドが直前に手放したコピーからの読み出しと, これからの書き込みを順序付ける
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  return *ptr;
+}
+
+// マスごとの, そのマスに利いている駒の一覧. Position に持たせると doMove, undoMove で差分更新される.
+// 表は大きいので, 必要な時だけ Position::enableAttackMap で作る. Position をコピーしても表は共有し, 書き換える時に初めて複製する.
+class AttackMap {
+public:
+  bool enabled() const {
+    return table != nullptr;
+  }
+  // index のマスに利いている color 側の駒. enabled() の時だけ呼べる.
+  Bitboard attackers(int index, Color color) const {
+    return (*table)[ColorIndex(color)][index];
+  }
+
+private:
+  // [ColorIndex][マスの添字]
+  using Table = std::array<std::array<Bitboard, 81>, 2>;
+  std::shared_ptr<Table> table;
+
+  friend struct Position;
+};
+
 // 盤面
 struct Position {
   Piece pieces[9][9]; // [筋][段]
 
+  // 以下は pieces から導出される情報. pieces を直接書き換えた場合は sync() を呼んで一致させること.
+  // 手番別の駒の有無. [ColorIndex]
+  Bitboard occupied[2];
+  // 駒の種類別の有無. 成っているかどうかは問わない. [PieceType]
+  Bitboard types[9];
+  // 成駒の有無
+  Bitboard promoted;
+  // 玉の居るマスの添字. 玉が居ない場合は -1. [ColorIndex]
+  int8_t kingSquare[2] = {-1, -1};
+  // 盤面, 持ち駒, 手番から計算したハッシュ値. apply で差分更新される.
+  uint64_t hash = 0;
+  // 利きの表. enableAttackMap を呼んだ後は apply, doMove, undoMove, sync で更新される.
+  AttackMap attackMap;
+
   // 手番 color の玉に王手がかかっているかどうかを判定
   bool isInCheck(Color color) const;
-
-  bool apply(Move const &, std::deque<PieceType> &handBlack, std::deque<PieceType> &handWhite);
+  // index のマスに利いている color 側の駒. 利きの表があれば表を引く.
+  Bitboard attackers(int index, Color color) const;
+  // 盤上の駒の有無が occupied だった場合に, index のマスに利いている color 側の駒.
+  Bitboard attackers(int index, Color color, Bitboard const &occupied) const;
+  // color 側の玉と, 相手の飛・角・香の間にあって動かせない color 側の駒.
+  Bitboard pinned(Color color) const;
+  // 手番をコンパイル時に固定した attackers, pinned. Color::Black と Color::White についてのみ実体化されている.
+  template <Color C>
+  Bitboard attackers(int index, Bitboard const &occupied) const;
+  template <Color C>
+  Bitboard pinned() const;
+  // C 側の玉と相手の飛・角・香の間にある唯一の駒. どちらの手番の駒も含む. 相手の駒であれば, それを動かすと開き王手になる.
+  template <Color C>
+  Bitboard blockers() const;
+  // color 側が index のマスに歩を打つと打ち歩詰めになるかどうか. index に打った歩が相手玉に王手となっていること.
+  bool isPawnDropMate(int index, Color color) const;
+
+  // 盤面と持ち駒に矛盾しない手であれば指して true を返す. 王手放置になる手は, 指した後の局面にして false を返す.
+  bool apply(Move const &, Hand &handBlack, Hand &handWhite);
+  // mv が盤面と持ち駒 hand (mv の手番側の持ち駒) に矛盾しないかどうか. 王手放置かどうかは判定しない.
+  bool isApplicable(Move const &mv, Hand const &hand) const;
+
+  // undoMove で doMove の前の状態に戻すための情報
+  struct Undo {
+    // 動かした駒 (成る前). 駒打ちの場合は打った駒.
+    Piece moved = 0;
+    // 取った駒. 取っていない場合は 0.
+    Piece captured = 0;
+    uint64_t hash = 0;
+  };
+  // 手を指す. 合法かどうかは確かめない.
+  Undo doMove(Move const &mv, Hand &handBlack, Hand &handWhite);
+  // doMove(mv, ...) で指した手を戻す.
+  void undoMove(Move const &mv, Undo const &undo, Hand &handBlack, Hand &handWhite);
   std::u8string debugString() const;
+
+  // pieces の内容からビットボードとハッシュ値を作り直す. ハッシュ値は持ち駒無しの先手番として計算する.
+  void sync();
+  // 持ち駒と手番も含めてハッシュ値を作り直す.
+  void sync(Hand const &handBlack, Hand const &handWhite, Color next);
+  // 盤上の駒だけから計算したハッシュ値に, 持ち駒と手番の分を足す. ビットボードは作り直さない.
+  void syncHand(Hand const &handBlack, Hand const &handWhite, Color next);
+  // index のマスに駒 p を置く. index のマスは空いていること.
+  void put(int index, Piece p);
+  // index のマスの駒を取り除き, その駒を返す.
+  Piece remove(int index);
+  // 利きの表を作る. 以後 pieces を直接書き換えた場合は sync() を呼ぶこと.
+  void enableAttackMap();
+  void disableAttackMap();
+
+  Piece at(int index) const {
+    return pieces[index / 9][index % 9];
+  }
+
+  Bitboard all() const {
+    return occupied[0] | occupied[1];
+  }
+
+private:
+  // 利きの表の差分更新. from, to は指し手で駒の有無が変わるマスで, 駒打ちの場合 from は -1.
+  // 盤面を変える前に beginAttackMapUpdate で影響を受ける駒の利きを表から消し, 変えた後に endAttackMapUpdate で付け直す.
+  Bitboard beginAttackMapUpdate(int from, int to);
+  void endAttackMapUpdate(Bitboard affected, int from, int to);
+  // squares のマスに居る駒の利きを表に足す (add = true), あるいは表から消す.
+  void updateAttackMap(Bitboard squares, bool add);
 };
 
 struct LessPosition {
@@ -377,14 +1052,20 @@ inline std::optional<std::u8string> KifStringFromHandicap(Handicap h) {
   }
 }
 
-// whiteHand を指定すると駒渡しになる
-inline Position MakePosition(Handicap h, std::deque<PieceType> *whiteHand = nullptr) {
-  Position p;
-  for (int x = 0; x < 9; x++) {
-    for (int y = 0; y < 9; y++) {
-      p.pieces[x][y] = 0;
-    }
-  }
+// 駒落ちの開始局面. Position から利きの表を除いたもので, コンパイル時に計算できる.
+struct HandicapPosition {
+  Piece pieces[9][9] = {};
+  // 以下は Position::sync() で pieces から導出されるものと同じ値
+  Bitboard occupied[2];
+  Bitboard types[9];
+  int8_t kingSquare[2] = {-1, -1};
+  uint64_t hash = 0;
+  // 落とした駒. 駒渡しの場合はこれを持ち駒にする.
+  Hand removed;
+};
+
+constexpr HandicapPosition MakeHandicapPosition(Handicap h) {
+  HandicapPosition p;
   // 後手
   for (int x = 0; x < 9; x++) {
     p.pieces[x][2] = MakePiece(Color::White, PieceType::Pawn);
@@ -407,10 +1088,8 @@ inline Position MakePosition(Handicap h, std::deque<PieceType> *whiteHand = null
   p.pieces[4][8] = MakePiece(Color::Black, PieceType::King);
   p.pieces[7][7] = MakePiece(Color::Black, PieceType::Rook);
   p.pieces[1][7] = MakePiece(Color::Black, PieceType::Bishop);
-  std::deque<PieceType> tmp;
-  std::deque<PieceType> *bin = whiteHand ? whiteHand : &tmp;
   auto drop = [&](int f, int r) {
-    bin->push_back(PieceTypeFromPiece(p.pieces[9 - f][r - 1]));
+    p.removed.add(PieceTypeFromPiece(p.pieces[9 - f][r - 1]));
     p.pieces[9 - (f)][(r)-1] = 0;
   };
   switch (h) {
@@ -546,16 +1225,73 @@ inline Position MakePosition(Handicap h, std::deque<PieceType> *whiteHand = null
       p.pieces[x][2] = 0;
       p.pieces[x][6] = 0;
     }
-    break;
+    break;
+  }
+  for (int index = 0; index < 81; index++) {
+    Piece piece = p.pieces[index / 9][index % 9];
+    if (piece == 0) {
+      continue;
+    }
+    p.occupied[ColorIndex(ColorFromPiece(piece))].set(index);
+    p.types[static_cast<PieceUnderlyingType>(PieceTypeFromPiece(piece))].set(index);
+    if (PieceTypeFromPiece(piece) == PieceType::King) {
+      p.kingSquare[ColorIndex(ColorFromPiece(piece))] = index;
+    }
+    p.hash ^= ZobristPiece(piece, index);
+  }
+  return p;
+}
+
+// [Handicap]
+inline constexpr auto kHandicapPositions = [] {
+  std::array<HandicapPosition, static_cast<int>(Handicap::青空将棋) + 1> t;
+  for (size_t i = 0; i < t.size(); i++) {
+    t[i] = MakeHandicapPosition(static_cast<Handicap>(i));
+  }
+  return t;
+}();
+
+// 青空将棋で取り除く歩を除けば, 盤上の駒と落とした駒を合わせて 40 枚になる
+static_assert([] {
+  for (size_t i = 0; i < kHandicapPositions.size(); i++) {
+    auto const &s = kHandicapPositions[i];
+    int pawns = static_cast<Handicap>(i) == Handicap::青空将棋 ? 18 : 0;
+    if ((s.occupied[0] | s.occupied[1]).count() + (int)s.removed.size() + pawns != 40) {
+      return false;
+    }
+    if (s.kingSquare[0] != 4 * 9 + 8 || s.kingSquare[1] != 4 * 9) {
+      return false;
+    }
+  }
+  return true;
+}());
+static_assert(kHandicapPositions[static_cast<int>(Handicap::平手)].removed.empty());
+// 香落ちは平手から１一の香を除いたもの
+static_assert(kHandicapPositions[static_cast<int>(Handicap::香落ち)].removed.count(PieceType::Lance) == 1 && kHandicapPositions[static_cast<int>(Handicap::香落ち)].removed.size() == 1);
+static_assert(kHandicapPositions[static_cast<int>(Handicap::香落ち)].pieces[8][0] == 0);
+static_assert((kHandicapPositions[static_cast<int>(Handicap::平手)].hash ^ kHandicapPositions[static_cast<int>(Handicap::香落ち)].hash) == ZobristPiece(MakePiece(Color::White, PieceType::Lance), 8 * 9));
+
+// whiteHand を指定すると駒渡しになる
+inline Position MakePosition(Handicap h, Hand *whiteHand = nullptr) {
+  HandicapPosition const &s = kHandicapPositions[static_cast<int>(h)];
+  Position p;
+  std::memcpy(p.pieces, s.pieces, sizeof(p.pieces));
+  std::memcpy(p.occupied, s.occupied, sizeof(p.occupied));
+  std::memcpy(p.types, s.types, sizeof(p.types));
+  p.promoted = Bitboard();
+  p.kingSquare[0] = s.kingSquare[0];
+  p.kingSquare[1] = s.kingSquare[1];
+  p.hash = s.hash;
+  if (whiteHand) {
+    for (PieceType type : Hand::kTypes) {
+      for (uint32_t i = 0; i < s.removed.count(type); i++) {
+        whiteHand->add(type);
+      }
+    }
   }
   return p;
 }
 
-// 持ち駒
-struct Hand {
-  std::deque<PieceType> pieces;
-};
-
 // 筋. 右が File1, 左が File9
 enum File : int32_t {
   File9 = 0,
@@ -569,7 +1305,7 @@ enum File : int32_t {
   File1,
 };
 
-inline std::u8string StringFromFile(File f) {
+constexpr std::u8string_view StringViewFromFile(File f) {
   switch (f) {
   case File1:
     return u8"１";
@@ -594,6 +1330,10 @@ inline std::u8string StringFromFile(File f) {
   }
 }
 
+inline std::u8string StringFromFile(File f) {
+  return std::u8string(StringViewFromFile(f));
+}
+
 // 段. 上が Rank1, 下が Rank9
 enum Rank : int32_t {
   Rank1 = 0,
@@ -607,7 +1347,7 @@ enum Rank : int32_t {
   Rank9,
 };
 
-inline std::u8string StringFromRank(Rank r) {
+constexpr std::u8string_view StringViewFromRank(Rank r) {
   switch (r) {
   case Rank1:
     return u8"一";
@@ -632,6 +1372,10 @@ inline std::u8string StringFromRank(Rank r) {
   }
 }
 
+inline std::u8string StringFromRank(Rank r) {
+  return std::u8string(StringViewFromRank(r));
+}
+
 struct Square {
   Square() = default;
   Square(File file, Rank rank) : file(file), rank(rank) {}
@@ -648,6 +1392,15 @@ inline Square MakeSquare(int x, int y) {
   return Square(static_cast<File>(x), static_cast<Rank>(y));
 }
 
+// Bitboard や Position#at で使うマスの添字.
+inline int IndexFromSquare(Square s) {
+  return s.file * 9 + s.rank;
+}
+
+inline Square SquareFromIndex(int index) {
+  return MakeSquare(index / 9, index % 9);
+}
+
 inline bool operator==(Square const &a, Square const &b) {
   return a.file == b.file && a.rank == b.rank;
 }
@@ -664,69 +1417,51 @@ struct LessSquare {
 
 using SquareSet = std::set<Square, LessSquare>;
 
+// 以下の Format*To は std::format_to と同じく, 文字列を out に書き込んで書き込んだ後の位置を返す.
+// out に固定長のバッファ (char8_t の配列や MoveStringBuffer) を渡せば, ヒープを使わずに文字列を作れる.
+template <class OutputIt>
+OutputIt FormatTo(OutputIt out, std::u8string_view s) {
+  return std::copy(s.begin(), s.end(), out);
+}
+
+template <class OutputIt>
+OutputIt FormatSquareTo(OutputIt out, Square s) {
+  out = FormatTo(out, StringViewFromFile(s.file));
+  return FormatTo(out, StringViewFromRank(s.rank));
+}
+
 inline std::u8string StringFromSquare(Square s) {
-  return StringFromFile(s.file) + StringFromRank(s.rank);
+  std::u8string ret;
+  FormatSquareTo(std::back_inserter(ret), s);
+  return ret;
 }
 
-inline std::optional<Square> TrimSquarePartFromString(std::u8string &inout) {
-  std::u8string s = inout;
-  static std::map<std::u8string, int32_t> const sMap = {
-      {u8"一", 0},
-      {u8"１", 0},
-      {u8"1", 0},
-      {u8"二", 1},
-      {u8"２", 1},
-      {u8"2", 1},
-      {u8"三", 2},
-      {u8"３", 2},
-      {u8"3", 2},
-      {u8"四", 3},
-      {u8"４", 3},
-      {u8"4", 3},
-      {u8"五", 4},
-      {u8"５", 4},
-      {u8"5", 4},
-      {u8"六", 5},
-      {u8"６", 5},
-      {u8"6", 5},
-      {u8"七", 6},
-      {u8"７", 6},
-      {u8"7", 6},
-      {u8"八", 7},
-      {u8"８", 7},
-      {u8"8", 7},
-      {u8"九", 8},
-      {u8"９", 8},
-      {u8"9", 8}};
-  std::optional<File> f;
-  for (auto const &it : sMap) {
-    if (s.starts_with(it.first)) {
-      f = static_cast<File>(8 - it.second);
-      s = s.substr(it.first.size());
-      break;
-    }
-  }
-  if (!f) {
+// s の offset バイト目から "７六" のようなマスを読み取る. 読み取れた場合は offset を進める.
+inline std::optional<Square> ParseSquare(std::u8string_view s, size_t &offset) {
+  size_t fileLength = 0;
+  NotationChar file = LookupNotationChar(s, offset, fileLength);
+  if (file.type != NotationCharType::Number) {
     return std::nullopt;
   }
-  std::optional<Rank> r;
-  for (auto const &it : sMap) {
-    if (s.starts_with(it.first)) {
-      r = static_cast<Rank>(it.second);
-      s = s.substr(it.first.size());
-      break;
-    }
-  }
-  if (!r) {
+  size_t rankLength = 0;
+  NotationChar rank = LookupNotationChar(s, offset + fileLength, rankLength);
+  if (rank.type != NotationCharType::Number) {
     return std::nullopt;
   }
-  inout.swap(s);
-  return Square(*f, *r);
+  offset += fileLength + rankLength;
+  return MakeSquare(9 - file.value, rank.value - 1);
+}
+
+inline std::optional<Square> TrimSquarePartFromString(std::u8string &inout) {
+  size_t offset = 0;
+  auto ret = ParseSquare(inout, offset);
+  inout.erase(0, offset);
+  return ret;
 }
 
-inline std::optional<Square> SquareFromString(std::u8string const &s) {
-  std::u8string cp = s;
-  return TrimSquarePartFromString(cp);
+inline std::optional<Square> SquareFromString(std::u8string_view s) {
+  size_t offset = 0;
+  return ParseSquare(s, offset);
 }
 
 // 手番 color の駒が from から to に移動したとき, 成れる条件かどうか.
@@ -867,31 +1602,171 @@ inline bool operator==(Move const &a, Move const &b) {
   return a.promote == b.promote;
 }
 
-inline std::u8string StringFromMoveWithLastPtr(Move const &mv, Square const *last) {
-  std::u8string ret;
-  if (mv.color == Color::Black) {
-    ret += u8"▲";
-  } else {
-    ret += u8"△";
+// 32bit に詰めた Move. Move と相互に変換しても情報は失われない (ただし Move::piece の手番は Move::color と同じであること).
+// bit 0~6: 移動元のマスの添字 (駒打ちの場合は 81), 7~13: 移動先のマスの添字, 14~18: 駒の種類と成り,
+// 19: 手番 (後手なら 1), 20~24: 取った駒 (取っていない場合は 0), 25~26: promote + 1, 27~31: suffix.
+struct PackedMove {
+  uint32_t value = 0;
+};
+
+inline bool operator==(PackedMove const &a, PackedMove const &b) {
+  return a.value == b.value;
+}
+
+inline PackedMove PackedMoveFromMove(Move const &mv) {
+  uint32_t from = mv.from ? IndexFromSquare(*mv.from) : 81;
+  uint32_t to = IndexFromSquare(mv.to);
+  uint32_t color = mv.color == Color::White ? 1 : 0;
+  uint32_t captured = mv.captured ? RemoveColorFromPiece(*mv.captured) : 0;
+  PackedMove p;
+  p.value = from | (to << 7) | (RemoveColorFromPiece(mv.piece) << 14) | (color << 19) | (captured << 20) | (uint32_t(mv.promote + 1) << 25) | (uint32_t(mv.suffix) << 27);
+  return p;
+}
+
+inline Move MoveFromPackedMove(PackedMove p) {
+  Move mv;
+  uint32_t from = p.value & 0x7f;
+  if (from != 81) {
+    mv.from = SquareFromIndex(from);
+  }
+  mv.to = SquareFromIndex((p.value >> 7) & 0x7f);
+  mv.color = ((p.value >> 19) & 1) ? Color::White : Color::Black;
+  mv.piece = static_cast<PieceUnderlyingType>(mv.color) | ((p.value >> 14) & 0x1f);
+  if (uint32_t captured = (p.value >> 20) & 0x1f; captured != 0) {
+    mv.captured = captured;
+  }
+  mv.promote = int((p.value >> 25) & 0x3) - 1;
+  mv.suffix = (p.value >> 27) & 0x1f;
+  return mv;
+}
+
+// 手の一覧. 1 局面の合法手は最大 593 手なので, その分の領域をあらかじめ確保しておく.
+class MoveList {
+public:
+  // 駒が 1 組の駒を超えない局面の合法手の最大数. SfenPositionFromString はこれを超え得る局面を読み取らない.
+  static constexpr size_t kCapacity = 593;
+
+  void push_back(Move const &mv) {
+    assert(size_ < kCapacity);
+    moves[size_++] = mv;
+  }
+
+  // i 番目の手を取り除く. 末尾の手を i 番目に移すので, 手の並び順は変わる.
+  void remove(size_t i) {
+    moves[i] = moves[--size_];
+  }
+
+  void clear() {
+    size_ = 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  Move &operator[](size_t i) {
+    return moves[i];
+  }
+
+  Move const &operator[](size_t i) const {
+    return moves[i];
+  }
+
+  Move *begin() {
+    return moves.data();
+  }
+
+  Move *end() {
+    return moves.data() + size_;
+  }
+
+  Move const *begin() const {
+    return moves.data();
+  }
+
+  Move const *end() const {
+    return moves.data() + size_;
+  }
+
+private:
+  std::array<Move, kCapacity> moves;
+  size_t size_ = 0;
+};
+
+// 指し手 1 手分の文字列を入れる固定長のバッファ. std::back_inserter で Format*To の出力先にできる.
+class MoveStringBuffer {
+public:
+  using value_type = char8_t;
+  // 棋譜の 1 行 ("999 ２四成銀(33)\r\n", "△２四成銀左上不成\r\n" など) も収まる長さ
+  static constexpr size_t kCapacity = 63;
+
+  void push_back(char8_t c) {
+    if (size_ < kCapacity) {
+      buffer[size_++] = c;
+      buffer[size_] = 0;
+    }
+  }
+
+  void clear() {
+    size_ = 0;
+    buffer[0] = 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  std::u8string_view view() const {
+    return std::u8string_view(buffer.data(), size_);
   }
+
+  // ヌル終端した文字列
+  char const *c_str() const {
+    return (char const *)buffer.data();
+  }
+
+private:
+  std::array<char8_t, kCapacity + 1> buffer = {};
+  size_t size_ = 0;
+};
+
+// "▲７六歩(77)" のような指し手. last は直前の手の移動先.
+template <class OutputIt>
+OutputIt FormatMoveTo(OutputIt out, Move const &mv, Square const *last) {
+  out = FormatTo(out, mv.color == Color::Black ? u8"▲" : u8"△");
   if (last && mv.to == *last) {
-    ret += u8"同";
+    out = FormatTo(out, u8"同");
   } else {
-    ret += StringFromSquare(mv.to);
+    out = FormatSquareTo(out, mv.to);
   }
   if (mv.promote == 1) {
-    ret += LongStringFromPieceTypeAndStatus(static_cast<PieceUnderlyingType>(PieceTypeFromPiece(mv.piece))) + u8"成";
+    out = FormatTo(out, LongStringViewFromPieceTypeAndStatus(static_cast<PieceUnderlyingType>(PieceTypeFromPiece(mv.piece))));
+    out = FormatTo(out, u8"成");
   } else if (mv.promote == -1) {
-    ret += LongStringFromPieceTypeAndStatus(mv.piece) + u8"不成";
+    out = FormatTo(out, LongStringViewFromPieceTypeAndStatus(mv.piece));
+    out = FormatTo(out, u8"不成");
   } else {
-    ret += LongStringFromPieceTypeAndStatus(mv.piece);
+    out = FormatTo(out, LongStringViewFromPieceTypeAndStatus(mv.piece));
   }
   if (mv.from) {
-    ret += u8"(" + std::u8string((char8_t const *)std::to_string(9 - mv.from->file).c_str()) + std::u8string((char8_t const *)std::to_string(mv.from->rank + 1).c_str()) + u8")";
+    *out++ = u8'(';
+    *out++ = char8_t(u8'0' + 9 - mv.from->file);
+    *out++ = char8_t(u8'0' + mv.from->rank + 1);
+    *out++ = u8')';
   } else {
-    ret += u8"打";
+    out = FormatTo(out, u8"打");
   }
-  return ret;
+  return out;
+}
+
+inline std::u8string StringFromMoveWithLastPtr(Move const &mv, Square const *last) {
+  MoveStringBuffer buffer;
+  FormatMoveTo(std::back_inserter(buffer), mv, last);
+  return std::u8string(buffer.view());
 }
 
 inline std::u8string StringFromMove(Move const &mv) {
@@ -1232,14 +2107,147 @@ enum class GameResultReason {
   CheckRepetition,
 };
 
+// 局面のハッシュ値をキーとした出現回数の表. 開番地法のハッシュ表で, 要素を削除する操作は無い.
+// コピーしてもスロットは共有し, 書き換える時に初めて複製する.
+class RepetitionTable {
+public:
+  size_t &operator[](uint64_t key) {
+    if ((size_ + 1) * 2 > slots->size()) {
+      rehash(slots->empty() ? 16 : slots->size() * 2);
+    } else {
+      Unshare(slots);
+    }
+    Slot &s = find(key);
+    if (s.count == 0) {
+      s.key = key;
+      size_++;
+    }
+    return s.count;
+  }
+
+  void clear() {
+    if (size_ == 0) {
+      return;
+    }
+    if (slots.use_count() > 1) {
+      slots = std::make_shared<std::vector<Slot>>();
+    } else {
+      std::fill(slots->begin(), slots->end(), Slot());
+    }
+    size_ = 0;
+  }
+
+private:
+  // count == 0 のスロットは空きとみなす
+  struct Slot {
+    uint64_t key = 0;
+    size_t count = 0;
+  };
+
+  Slot &find(uint64_t key) {
+    auto &v = *slots;
+    size_t mask = v.size() - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask) {
+      if (v[i].count == 0 || v[i].key == key) {
+        return v[i];
+      }
+    }
+  }
+
+  void rehash(size_t capacity) {
+    auto old = slots;
+    slots = std::make_shared<std::vector<Slot>>(capacity);
+    size_ = 0;
+    for (Slot const &s : *old) {
+      if (s.count > 0) {
+        find(s.key) = s;
+        size_++;
+      }
+    }
+  }
+
+  std::shared_ptr<std::vector<Slot>> slots = std::make_shared<std::vector<Slot>>();
+  // 使用中のスロット数. operator[] で参照しただけのスロットも数えるので, 実際より多いことがある.
+  size_t size_ = 0;
+};
+
+// 棋譜. std::deque<PackedMove> と同じように使えるが, コピーしても中身は共有し, 書き換える時に初めて複製する.
+// Game をフレーム毎に Status へコピーしても, 手数に比例する時間が掛からないようにするため.
+class MoveHistory {
+public:
+  using value_type = PackedMove;
+  using const_iterator = std::deque<PackedMove>::const_iterator;
+  using const_reverse_iterator = std::deque<PackedMove>::const_reverse_iterator;
+
+  size_t size() const {
+    return moves->size();
+  }
+  bool empty() const {
+    return moves->empty();
+  }
+  PackedMove const &operator[](size_t index) const {
+    return (*moves)[index];
+  }
+  PackedMove const &front() const {
+    return moves->front();
+  }
+  PackedMove const &back() const {
+    return moves->back();
+  }
+  const_iterator begin() const {
+    return moves->cbegin();
+  }
+  const_iterator end() const {
+    return moves->cend();
+  }
+  const_reverse_iterator rbegin() const {
+    return moves->crbegin();
+  }
+  const_reverse_iterator rend() const {
+    return moves->crend();
+  }
+  std::deque<PackedMove> const &deque() const {
+    return *moves;
+  }
+
+  void push_back(PackedMove mv) {
+    Unshare(moves).push_back(mv);
+  }
+  void pop_back() {
+    Unshare(moves).pop_back();
+  }
+  void clear() {
+    if (moves.use_count() > 1) {
+      moves = std::make_shared<std::deque<PackedMove>>();
+    } else {
+      moves->clear();
+    }
+  }
+
+private:
+  std::shared_ptr<std::deque<PackedMove>> moves = std::make_shared<std::deque<PackedMove>>();
+};
+
 class Game {
 public:
   // 駒渡しにする時 hand = true
-  Game(Handicap h, bool hand) : handicap_(h), handicapHand_(hand) {
+  Game(Handicap h, bool hand) {
+    reset(h, hand);
+  }
+
+  // 対局開始時の状態に戻す. 棋譜と千日手の表の領域は, 他と共有していなければ再利用する.
+  void reset(Handicap h, bool hand) {
+    handicap_ = h;
+    handicapHand_ = hand;
+    handBlack = Hand();
+    handWhite = Hand();
     position = MakePosition(h, hand ? &handBlack : nullptr);
-    if (h != Handicap::平手) {
-      first = Color::White;
-    }
+    first = h == Handicap::平手 ? Color::Black : Color::White;
+    position.syncHand(handBlack, handWhite, first);
+    moves.clear();
+    history.clear();
+    blackCheckHistory.clear();
+    whiteCheckHistory.clear();
   }
 
   enum class ApplyResult {
@@ -1250,9 +2258,10 @@ public:
     CheckRepetitionWhite,
   };
 
+  // 手を指す. 王手放置と打ち歩詰めで Illegal を返す時は, 指した後の局面になっている.
   ApplyResult apply(Move const &move);
 
-  std::deque<PieceType> &hand(Color color) {
+  Hand &hand(Color color) {
     if (color == Color::Black) {
       return handBlack;
     } else {
@@ -1260,7 +2269,7 @@ public:
     }
   }
 
-  std::deque<PieceType> const &hand(Color color) const {
+  Hand const &hand(Color color) const {
     if (color == Color::Black) {
       return handBlack;
     } else {
@@ -1268,7 +2277,15 @@ public:
     }
   }
 
-  static void Generate(Position const &p, Color color, std::deque<PieceType> const &handBlack, std::deque<PieceType> const &handWhite, std::deque<Move> &moves, bool enablePawnCheckByDrop);
+  static void Generate(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite, MoveList &moves, bool enablePawnCheckByDrop);
+  static void Generate(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite, std::deque<Move> &moves, bool enablePawnCheckByDrop);
+  // Generate が生成する合法手のうち, 駒を取る手だけを生成する.
+  static void GenerateCaptures(Position const &p, Color color, MoveList &moves);
+  // Generate が生成する合法手のうち, 相手玉に王手を掛ける手だけを生成する.
+  static void GenerateChecks(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite, MoveList &moves, bool enablePawnCheckByDrop);
+  // color 側に王手が掛かっている時, それを回避する手を生成する. 王手が掛かっていなければ何も生成しない.
+  static void GenerateEvasions(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite, MoveList &moves, bool enablePawnCheckByDrop);
+  void generate(MoveList &moves) const;
   void generate(std::deque<Move> &moves) const;
 
   Color next() const {
@@ -1277,23 +2294,193 @@ public:
 
 public:
   Position position;
-  std::deque<Move> moves;
-  std::deque<PieceType> handBlack;
-  std::deque<PieceType> handWhite;
+  MoveHistory moves;
+  Hand handBlack;
+  Hand handWhite;
   Color first = Color::Black;
   Handicap handicap_;
   bool handicapHand_;
 
 private:
-  std::map<Position, size_t, LessPosition> history;
-  std::map<Position, size_t, LessPosition> blackCheckHistory;
-  std::map<Position, size_t, LessPosition> whiteCheckHistory;
+  // 局面のハッシュ値をキーとした出現回数
+  RepetitionTable history;
+  RepetitionTable blackCheckHistory;
+  RepetitionTable whiteCheckHistory;
+};
+
+// ある局面の合法手の集合. 局面が変わるたびに reset で作り直し, 指し手が合法かどうかを定数時間で調べる.
+class LegalMoveSet {
+public:
+  void reset(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite);
+
+  bool contains(Move const &mv) const;
+  // from の駒を to へ動かす手. promote == true なら成る手.
+  bool contains(Square from, Square to, bool promote) const {
+    return find(Key(IndexFromSquare(from), IndexFromSquare(to), PieceType::Empty, promote));
+  }
+  bool containsDrop(PieceType type, Square to) const {
+    return find(Key(-1, IndexFromSquare(to), type, false));
+  }
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  // 合法手の数は多くても 600 手程度なので, 十分に空きが残る大きさにする.
+  static constexpr size_t kCapacity = 2048;
+
+  // 0 にはならない. 0 は空きスロットを表す.
+  static uint32_t Key(int from, int to, PieceType drop, bool promote) {
+    return uint32_t(from + 1) << 12 | uint32_t(to) << 5 | uint32_t(static_cast<PieceUnderlyingType>(drop)) << 1 | (promote ? 1 : 0);
+  }
+  static size_t Slot(uint32_t key) {
+    return (key * uint32_t(0x9e3779b1)) >> (32 - std::countr_zero(kCapacity));
+  }
+  bool find(uint32_t key) const {
+    for (size_t i = Slot(key);; i = (i + 1) & (kCapacity - 1)) {
+      if (slots[i] == key) {
+        return true;
+      }
+      if (slots[i] == 0) {
+        return false;
+      }
+    }
+  }
+
+  std::array<uint32_t, kCapacity> slots{};
+  size_t size_ = 0;
+};
+
+// ReplayGames に渡す 1 局分の棋譜.
+struct ReplayGame {
+  Handicap handicap = Handicap::平手;
+  bool handicapHand = false;
+  std::vector<PackedMove> moves;
+};
+
+struct ReplayResult {
+  Game::ApplyResult result = Game::ApplyResult::Ok;
+  // result が Ok なら再生した手数. それ以外の場合は result になった手が何手目か.
+  size_t ply = 0;
+};
+
+// 棋譜をまとめて Game::apply で再生し, 反則や千日手が無いかを調べる. 結果は games と同じ順に返す.
+// threads 個のスレッドで並列に再生する. threads == 0 ならハードウェアのスレッド数を使う.
+std::vector<ReplayResult> ReplayGames(std::span<ReplayGame const> games, unsigned threads = 0);
+
+// SFEN 形式の局面.
+struct SfenPosition {
+  Position position;
+  Hand handBlack;
+  Hand handWhite;
+  Color next = Color::Black;
+  int ply = 1;
+};
+
+// "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1" のような SFEN の局面部分を読み取る. 手数は省略できる.
+// 盤上と持ち駒の駒が 1 組の駒より多い局面と, 玉が 2 枚以上ある側や手番でない側に玉が無い局面は読み取らない.
+std::optional<SfenPosition> SfenPositionFromString(std::string_view sfen);
+std::string SfenStringFromPosition(Position const &position, Hand const &handBlack, Hand const &handWhite, Color next, int ply = 1);
+// "7g7f", "8h2b+", "P*5e" のような SFEN の指し手を読み取る. 駒の種類や取った駒は position から補う.
+std::optional<Move> MoveFromSfenMove(std::string_view sfen, Position const &position, Color color);
+std::string SfenStringFromMove(Move const &mv);
+// "sfen <局面> moves <指し手>..." の形式で, 開始局面と棋譜を書き出す.
+std::string SfenStringFromGame(Game const &game);
+// "startpos" または "sfen <局面>" に続けて "moves <指し手>..." を並べたものを読み取る. 先頭の "position " は省略できる.
+std::optional<Game> GameFromSfenString(std::string_view sfen);
+
+// df-pn による詰み探索. 攻め方は王手を掛け続けるものとする.
+class MateSolver {
+public:
+  enum class Result {
+    Mate,    // 詰み
+    NoMate,  // 不詰
+    Unknown, // 探索の上限に達したか, 中断された
+  };
+
+  struct Answer {
+    Result result = Result::Unknown;
+    // 詰みの場合の手順. 最短手順とは限らない.
+    std::vector<Move> moves;
+    // 探索した局面の数
+    uint64_t nodes = 0;
+  };
+
+  // 探索する最大の手数
+  static constexpr int kMaxPly = 127;
+
+  // tableSize: 置換表のエントリ数. 2 の冪に切り上げる.
+  explicit MateSolver(size_t tableSize = size_t(1) << 20);
+
+  // color の手番で, color 側が相手玉を詰ませられるかどうかを調べる. maxNodes 局面を探索するか, timeout を超えるか, stop() が呼ばれると Unknown を返す.
+  // stop() が呼ばれた後は, resetStop() を呼ぶまですぐに Unknown を返す.
+  Answer solve(Position const &position, Color color, Hand const &handBlack, Hand const &handWhite, uint64_t maxNodes, std::chrono::milliseconds timeout);
+  // 探索を中断する. solve とは別のスレッドから呼んでよい.
+  void stop() {
+    stopSignal = true;
+  }
+  // stop() による中断を解除する. 別のスレッドから stop() を呼ぶ場合は, 次の solve の入力を受け取るのと同じ排他の中で呼ぶ.
+  void resetStop() {
+    stopSignal = false;
+  }
+  // 置換表を空にする.
+  void clear();
+
+private:
+  struct Entry {
+    uint64_t key = 0;
+    // 証明数と反証数. 両方 0 のエントリは空きとして扱う.
+    uint32_t pn = 0;
+    uint32_t dn = 0;
+    // 詰みが証明された局面の, 詰みまでの手数.
+    uint32_t length = 0;
+    // 書き込んだ時の generation. 詰みでないエントリは手数の上限に依存するので, 同じ generation の時だけ参照する.
+    uint32_t generation = 0;
+  };
+  // 置換表の 1 組のエントリ数
+  static constexpr size_t kBucketSize = 4;
+  // 1 手ごとの作業領域.
+  struct Frame {
+    MoveList moves;
+    std::array<uint64_t, MoveList::kCapacity> hashes;
+  };
+
+  void search(Color side, uint32_t thPhi, uint32_t thDelta, int ply);
+  void generate(Color side, MoveList &moves) const;
+  Entry lookup(uint64_t key) const;
+  void store(uint64_t key, uint32_t pn, uint32_t dn, uint32_t length);
+  // store で上書きする時の優先度. 値の小さいものから上書きする.
+  int priority(Entry const &e) const;
+  bool interrupted();
+
+  std::vector<Entry> table;
+  std::deque<Frame> frames;
+  std::vector<uint64_t> path;
+  Position position;
+  Hand handBlack;
+  Hand handWhite;
+  Color attacker = Color::Black;
+  // 置換表のキー. 局面のハッシュ値にこれを xor したものを使う. 攻め方によって変わる.
+  uint64_t attackerKey = 0;
+  // 手数の上限. 上限を超えた手順は不詰として扱い, 上限を徐々に増やして探索する.
+  int limit = 0;
+  // 手数の上限によって不詰とした局面があったかどうか.
+  bool limited = false;
+  // 手数の上限を変えるたびに増やす.
+  uint32_t generation = 0;
+  // solve を始めた時の generation.
+  uint32_t rootGeneration = 0;
+  uint64_t nodes = 0;
+  uint64_t maxNodes = 0;
+  std::chrono::steady_clock::time_point deadline;
+  bool aborted = false;
+  std::atomic_bool stopSignal = false;
 };
 
 class Player {
 public:
   virtual ~Player() {}
-  virtual std::optional<Move> next(Position const &p, Color next, std::deque<Move> const &moves, std::deque<PieceType> const &hand, std::deque<PieceType> const &handEnemy) = 0;
+  virtual std::optional<Move> next(Position const &p, Color next, std::deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) = 0;
   virtual std::optional<std::u8string> name() = 0;
   virtual void stop() = 0;
 };
@@ -1301,7 +2488,7 @@ public:
 class RandomAI : public Player {
 public:
   RandomAI();
-  std::optional<Move> next(Position const &p, Color next, std::deque<Move> const &moves, std::deque<PieceType> const &hand, std::deque<PieceType> const &handEnemy) override;
+  std::optional<Move> next(Position const &p, Color next, std::deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) override;
   std::optional<std::u8string> name() override {
     return u8"random";
   }
@@ -1315,7 +2502,7 @@ class Sunfish3AI : public Player {
 public:
   Sunfish3AI();
   ~Sunfish3AI();
-  std::optional<Move> next(Position const &p, Color next, std::deque<Move> const &moves, std::deque<PieceType> const &hand, std::deque<PieceType> const &handEnemy) override;
+  std::optional<Move> next(Position const &p, Color next, std::deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) override;
   std::optional<std::u8string> name() override {
     return u8"sunfish3";
   }
@@ -1330,7 +2517,7 @@ class Micro686AI : public Player {
 public:
   Micro686AI();
   ~Micro686AI();
-  std::optional<Move> next(Position const &p, Color next, std::deque<Move> const &moves, std::deque<PieceType> const &hand, std::deque<PieceType> const &handEnemy) override;
+  std::optional<Move> next(Position const &p, Color next, std::deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) override;
   std::optional<std::u8string> name() override {
     return u8"686micro";
   }
@@ -1385,7 +2572,7 @@ struct CsaPositionReceiver {
   std::optional<Game> validate() const;
 };
 
-inline std::optional<PieceUnderlyingType> PieceTypeFromCsaString(std::string const &p) {
+inline std::optional<PieceUnderlyingType> PieceTypeFromCsaString(std::string_view p) {
   if (p == "FU") {
     return static_cast<PieceUnderlyingType>(PieceType::Pawn);
   } else if (p == "KY") {
@@ -1419,29 +2606,24 @@ inline std::optional<PieceUnderlyingType> PieceTypeFromCsaString(std::string con
   }
 }
 
-inline std::variant<Move, std::u8string> MoveFromCsaMove(std::string const &msg, Position const &position) {
+inline std::variant<Move, std::u8string> MoveFromCsaMove(std::string_view msg, Position const &position) {
   using namespace std;
-  if (!msg.starts_with("+") && !msg.starts_with("-")) {
+  if (msg.size() < 7 || (msg[0] != '+' && msg[0] != '-')) {
     return u8"指し手を読み取れませんでした";
   }
-  if (msg.size() < 7) {
-    return u8"指し手を読み取れませんでした";
-  }
-  Color color = Color::Black;
-  if (msg.starts_with("-")) {
-    color = Color::White;
-  }
-  auto fromFile = atoi(msg.substr(1, 1).c_str());
-  auto fromRank = atoi(msg.substr(2, 1).c_str());
-  auto toFile = atoi(msg.substr(3, 1).c_str());
-  auto toRank = atoi(msg.substr(4, 1).c_str());
+  Color color = msg[0] == '-' ? Color::White : Color::Black;
+  // 数字でなければ -1
+  auto digit = [msg](size_t i) {
+    return '0' <= msg[i] && msg[i] <= '9' ? msg[i] - '0' : -1;
+  };
+  int fromFile = digit(1);
+  int fromRank = digit(2);
+  int toFile = digit(3);
+  int toRank = digit(4);
   auto piece = PieceTypeFromCsaString(msg.substr(5, 2));
   if (!piece) {
     return u8"指し手を読み取れませんでした";
   }
-  if (!msg.substr(1).starts_with(to_string(fromFile) + to_string(fromRank) + to_string(toFile) + to_string(toRank))) {
-    return u8"指し手を読み取れませんでした";
-  }
   if (fromFile < 0 || 9 < fromFile || fromRank < 0 || 9 < fromRank || toFile < 1 || 9 < toFile || toRank < 1 || 9 < toRank) {
     return u8"指し手を読み取れませんでした";
   }
@@ -1479,7 +2661,7 @@ inline std::variant<Move, std::u8string> MoveFromCsaMove(std::string const &msg,
   return mv;
 }
 
-std::optional<std::string> CsaStringFromPiece(Piece p, int promote) {
+inline std::optional<std::string> CsaStringFromPiece(Piece p, int promote) {
   bool promoted = IsPromotedPiece(p);
   auto type = PieceTypeFromPiece(p);
   if (type == PieceType::Pawn) {
@@ -1592,7 +2774,7 @@ public:
 
   explicit CsaAdapter(std::weak_ptr<CsaServer> server);
   ~CsaAdapter();
-  std::optional<Move> next(Position const &p, Color next, std::deque<Move> const &moves, std::deque<PieceType> const &hand, std::deque<PieceType> const &handEnemy) override;
+  std::optional<Move> next(Position const &p, Color next, std::deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) override;
   std::optional<std::u8string> name() override;
   void stop() override;
   std::string name() const override { return "Player"; }
@@ -1625,7 +2807,7 @@ private:
   std::condition_variable cv;
   std::mutex mut;
   std::atomic_bool stopSignal;
-  std::deque<Move> moves;
+  std::deque<PackedMove> moves;
   Game game;
 
   CsaPositionReceiver positionReceiver;
@@ -1740,6 +2922,13 @@ struct Status {
     GameResultReason reason;
   };
   std::optional<Result> result;
+  // 手番側に詰みがある時の詰み手順. 別スレッドで探索するので, 最新の局面より古い局面のものの場合がある.
+  struct Mate {
+    // 何手指した後の局面か. game.moves.size() と比較して使う.
+    size_t ply;
+    std::vector<Move> moves;
+  };
+  std::optional<Mate> mate;
   std::shared_ptr<PieceBook> book;
   std::deque<std::map<std::pair<int, int>, std::set<std::shared_ptr<Lattice>>>> clusters;
   Ternary yourTurnFirst = Ternary::None;
@@ -1767,6 +2956,163 @@ struct BoardImage {
   }
 };
 
+// 棋譜ファイルの形式
+enum class KifuFormat {
+  Kif, // "1 ７六歩(77)" のように, 1 手ずつ移動元を付けて書く
+  Ki2, // "▲７六歩" のように, 必要な時だけ "右" "上" などを付けて書く
+};
+
+// 棋譜ファイルの先頭に書く情報.
+struct KifuHeader {
+  // "2024/01/02 03:04:05" のような日時. 省略すると書かない.
+  std::optional<std::u8string> startDateTime;
+  std::optional<std::u8string> endDateTime;
+  std::u8string black;
+  std::u8string white;
+  Handicap handicap = Handicap::平手;
+  bool handicapHand = false;
+};
+
+// "７六歩(77)" のような KIF 形式の指し手. last は直前の手の移動先.
+template <class OutputIt>
+OutputIt FormatKifMoveTo(OutputIt out, Move const &mv, std::optional<Square> last) {
+  if (last && *last == mv.to) {
+    out = FormatTo(out, u8"同");
+  } else {
+    out = FormatSquareTo(out, mv.to);
+  }
+  if (mv.promote == 1) {
+    out = FormatTo(out, ShortStringViewFromPieceTypeAndStatus(Unpromote(mv.piece)));
+    out = FormatTo(out, u8"成");
+  } else {
+    out = FormatTo(out, ShortStringViewFromPieceTypeAndStatus(mv.piece));
+  }
+  if (mv.from) {
+    *out++ = u8'(';
+    *out++ = char8_t(u8'0' + 9 - mv.from->file);
+    *out++ = char8_t(u8'0' + mv.from->rank + 1);
+    *out++ = u8')';
+  } else {
+    out = FormatTo(out, u8"打");
+  }
+  return out;
+}
+
+// "▲７六歩" のような KI2 形式の指し手. mv.suffix は decideSuffix で決めておくこと.
+template <class OutputIt>
+OutputIt FormatKi2MoveTo(OutputIt out, Move const &mv, std::optional<Square> last) {
+  out = FormatTo(out, mv.color == Color::Black ? u8"▲" : u8"△");
+  if (last && *last == mv.to) {
+    out = FormatTo(out, u8"同");
+  } else {
+    out = FormatSquareTo(out, mv.to);
+  }
+  if (mv.promote == 1) {
+    out = FormatTo(out, LongStringViewFromPieceTypeAndStatus(static_cast<PieceUnderlyingType>(PieceTypeFromPiece(mv.piece))));
+  } else {
+    out = FormatTo(out, LongStringViewFromPieceTypeAndStatus(mv.piece));
+  }
+  switch (static_cast<SuffixType>(mv.suffix & static_cast<SuffixUnderlyingType>(SuffixType::MaskPosition))) {
+  case SuffixType::Right:
+    out = FormatTo(out, u8"右");
+    break;
+  case SuffixType::Left:
+    out = FormatTo(out, u8"左");
+    break;
+  case SuffixType::Nearest:
+    out = FormatTo(out, u8"直");
+    break;
+  default:
+    break;
+  }
+  switch (static_cast<SuffixType>(mv.suffix & static_cast<SuffixUnderlyingType>(SuffixType::MaskAction))) {
+  case SuffixType::Up:
+    out = FormatTo(out, u8"上");
+    break;
+  case SuffixType::Down:
+    out = FormatTo(out, u8"引");
+    break;
+  case SuffixType::Sideway:
+    out = FormatTo(out, u8"寄");
+    break;
+  case SuffixType::Drop:
+    out = FormatTo(out, u8"打");
+    break;
+  default:
+    break;
+  }
+  if (mv.promote == 1) {
+    out = FormatTo(out, u8"成");
+  } else if (mv.promote == -1) {
+    out = FormatTo(out, u8"不成");
+  }
+  return out;
+}
+
+std::u8string KifStringFromMove(Move const &mv, std::optional<Square> last);
+std::u8string Ki2StringFromMove(Move const &mv, std::optional<Square> last);
+// 対局全体の棋譜. result を指定すると終局の理由と勝敗も書く.
+std::u8string KifuStringFromGame(Game const &game, KifuHeader const &header, std::optional<Status::Result> result, KifuFormat format);
+
+// 対局中に, 確定した指し手を 1 手ずつ棋譜ファイルへ書き足す.
+// 各行はすぐに書き込み, kSyncInterval 手ごとにまとめて fsync する. アプリが落ちても書き込んだ所までは残る.
+class KifuWriter {
+public:
+  static constexpr size_t kSyncInterval = 8;
+
+  explicit KifuWriter(KifuFormat format) : format(format) {}
+  ~KifuWriter() {
+    close();
+  }
+  KifuWriter(KifuWriter const &) = delete;
+  KifuWriter &operator=(KifuWriter const &) = delete;
+
+  // path のファイルを作り直して header を書き込む.
+  bool open(std::string const &path, KifuHeader const &header);
+  // mv は decideSuffix 済みのもの.
+  bool append(Move const &mv);
+  // 終局の理由と勝敗を書いて閉じる.
+  bool finish(Status::Result const &result);
+  void close();
+
+  bool isOpen() const {
+    return fd >= 0;
+  }
+  // 書き込んだ手数
+  size_t ply() const {
+    return ply_;
+  }
+
+private:
+  bool write(std::u8string_view lines);
+  bool sync();
+
+  KifuFormat const format;
+  int fd = -1;
+  size_t ply_ = 0;
+  std::optional<Square> last;
+  size_t unsynced = 0;
+};
+
+// 棋譜ファイルから読み取った 1 局分の棋譜.
+struct KifuRecord {
+  // ReplayGames にそのまま渡せる. 途中で読み取れなくなった場合は, その前の手までが入る.
+  ReplayGame game;
+  // 読み取れなかった理由と, その行番号 (1 始まり).
+  std::optional<std::u8string> error;
+  size_t line = 0;
+};
+
+// text に含まれる KIF, KI2, CSA 形式の棋譜を先頭から読み取り, 1 局読み終えるごとに callback を呼ぶ. 読み取った局数を返す.
+// 形式は行ごとに判別するので, 1 つの text に複数の形式が混ざっていてもよい. 文字コードは UTF-8 のみ.
+// 指し手は盤面と持ち駒に矛盾しないかだけを確かめる. 二歩や千日手などは ReplayGames で調べること.
+size_t ParseKifu(std::u8string_view text, std::function<void(KifuRecord &&)> const &callback);
+// path のファイルを mmap して ParseKifu で読み取る. ファイルを開けなかった場合は false.
+bool ParseKifuFile(std::string const &path, std::function<void(KifuRecord &&)> const &callback);
+// paths のファイルを threads 個のスレッドで並列に読み取る. 結果はファイルごとに, paths と同じ順に返す.
+// 開けなかったファイルについては error だけを入れた KifuRecord を 1 つ返す. threads == 0 ならハードウェアのスレッド数を使う.
+std::vector<std::vector<KifuRecord>> ParseKifuFiles(std::span<std::string const> paths, unsigned threads = 0);
+
 struct LessCvPoint {
   constexpr bool operator()(cv::Point const &a, cv::Point const &b) const {
     if (a.x == b.x) {
@@ -1805,21 +3151,27 @@ struct Statistics {
                                      cv::Mat const &boardFullcolor,
                                      Status &s,
                                      Game &g,
-                                     std::vector<Move> &detected,
+                                     std::vector<PackedMove> &detected,
                                      bool detectMove);
   // 盤面画像を180度回転してから盤面認識処理すべき場合に true.
   bool rotate = false;
 
   std::deque<Move> moveCandidateHistory;
+  // 確定した指し手を書き足していく棋譜ファイル. 無ければ書かない.
+  std::shared_ptr<KifuWriter> kifu;
+  // 確定済みの局面の合法手. legalMovesHash は作った時の局面のハッシュ値.
+  LegalMoveSet legalMoves;
+  std::optional<uint64_t> legalMovesHash;
 
   static std::optional<Move> Detect(cv::Mat const &boardBeforeGray, cv::Mat const &boardBeforeColor,
                                     cv::Mat const &boardAfterGray, cv::Mat const &boardAfterColor,
                                     std::vector<std::shared_ptr<PieceContour>> const &pieces,
                                     CvPointSet const &changes,
                                     Position const &position,
-                                    std::vector<Move> const &moves,
+                                    std::vector<PackedMove> const &moves,
                                     Color const &color,
-                                    std::deque<PieceType> const &hand,
+                                    Hand const &hand,
+                                    LegalMoveSet const &legalMoves,
                                     PieceBook &book,
                                     std::optional<Move> hint,
                                     Status const &s,
@@ -1884,6 +3236,8 @@ public:
     return *cp;
   }
   void setHandicap(Handicap h, bool handicapHand);
+  // 以後確定した指し手を path の棋譜ファイルに書き足していく. 既に指した手もまとめて書く.
+  void recordKifu(std::string const &path, KifuHeader const &header, KifuFormat format);
   void startGame(GameStartParameter parameter);
   void stopGame();
   void resign(Color color);
@@ -1895,6 +3249,7 @@ public:
 private:
   void run();
   void runPlayer();
+  void runMate();
   void unsafeResign(Color color, Status &s);
 
 private:
@@ -1902,30 +3257,32 @@ private:
   std::condition_variable runThreadCv;
   std::thread playerThread;
   std::condition_variable playerThreadCv;
+  std::thread mateThread;
+  std::condition_variable mateThreadCv;
   std::atomic<bool> stop;
   std::mutex mut;
   std::deque<cv::Mat> queue;
   std::shared_ptr<Status> s;
   Statistics stat;
   Game game;
-  std::vector<Move> detected;
+  std::vector<PackedMove> detected;
   std::shared_ptr<PlayerConfig> playerConfig;
   std::shared_ptr<Players> players;
   struct Input {
     Input(std::shared_ptr<Player> player,
           Position position,
           Color color,
-          std::deque<Move> moves,
-          std::deque<PieceType> hand,
-          std::deque<PieceType> handEnemy) : player(player), position(position), color(color), moves(moves), hand(hand), handEnemy(handEnemy) {
+          MoveHistory moves,
+          Hand hand,
+          Hand handEnemy) : player(player), position(position), color(color), moves(moves), hand(hand), handEnemy(handEnemy) {
     }
 
     std::shared_ptr<Player> const player;
     Position const position;
     Color const color;
-    std::deque<Move> const moves;
-    std::deque<PieceType> const hand;
-    std::deque<PieceType> const handEnemy;
+    MoveHistory const moves;
+    Hand const hand;
+    Hand const handEnemy;
   };
   struct Output {
     Color color;
@@ -1934,6 +3291,28 @@ private:
   std::unique_ptr<Input> nextInput;
   std::unique_ptr<std::future<Output>> nextFuture;
   std::unique_ptr<std::promise<Output>> nextPromise;
+  struct MateInput {
+    MateInput(size_t ply,
+              Position position,
+              Color color,
+              Hand handBlack,
+              Hand handWhite) : ply(ply), position(position), color(color), handBlack(handBlack), handWhite(handWhite) {
+    }
+
+    size_t const ply;
+    Position const position;
+    Color const color;
+    Hand const handBlack;
+    Hand const handWhite;
+  };
+  // 詰み探索を依頼する局面. 探索中に新しい局面を依頼すると, 探索中のものは中断する.
+  std::unique_ptr<MateInput> nextMateInput;
+  std::optional<Status::Mate> mate;
+  // 詰み探索を依頼済みの局面のハッシュ値と手番
+  std::optional<std::pair<uint64_t, Color>> mateRequested;
+  MateSolver mateSolver;
+  // recordKifu で開いた棋譜ファイル. run で stat.kifu に移す.
+  std::shared_ptr<KifuWriter> nextKifu;
   std::u8string error;
   bool started = false;
 };
@@ -1980,6 +3359,17 @@ public:
   static CFStringRef CFStringFromU8String(std::u8string const &s) {
     return CFStringCreateWithCString(kCFAllocatorDefault, (char const *)s.c_str(), kCFStringEncodingUTF8);
   }
+  // StringFromMove と同じ文字列を, std::u8string を経由せずに作る.
+  static CFStringRef CFStringFromMove(Move const &mv) {
+    MoveStringBuffer buffer;
+    FormatMoveTo(std::back_inserter(buffer), mv, nullptr);
+    return CFStringCreateWithBytes(kCFAllocatorDefault, (UInt8 const *)buffer.view().data(), buffer.size(), kCFStringEncodingUTF8, false);
+  }
+  static CFStringRef CFStringFromMove(Move const &mv, Square last) {
+    MoveStringBuffer buffer;
+    FormatMoveTo(std::back_inserter(buffer), mv, &last);
+    return CFStringCreateWithBytes(kCFAllocatorDefault, (UInt8 const *)buffer.view().data(), buffer.size(), kCFStringEncodingUTF8, false);
+  }
 #endif // defined(__APPLE__)
 };
 
@@ -1999,6 +3389,10 @@ public:
     ptr->setHandicap(h, handicapHand);
   }
 
+  void recordKifu(std::string const &path, KifuHeader const &header, KifuFormat format) {
+    ptr->recordKifu(path, header, format);
+  }
+
   void startGame(Color userColor, int option) {
     GameStartParameter p;
     p.userColor = userColor;
@@ -2087,7 +3481,7 @@ inline PngLogger LogPng(std::string const &pngData) {
   return logger;
 }
 
-colormap::Color ColorFromColormap(float v) {
+inline colormap::Color ColorFromColormap(float v) {
   static colormap::MATLAB::Jet sJet;
   return sJet.getColor(v);
 }
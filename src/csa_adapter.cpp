@@ -225,8 +225,8 @@ void CsaAdapter::onmessage(string const &msg) {
           lock_guard<mutex> lock(mut);
           switch (game.apply(m)) {
           case Game::ApplyResult::Ok: {
-            game.moves.push_back(m);
-            moves.push_back(m);
+            game.moves.push_back(PackedMoveFromMove(m));
+            moves.push_back(PackedMoveFromMove(m));
             cv.notify_all();
             break;
           }
@@ -323,12 +323,12 @@ void CsaAdapter::notifyResult() {
   }
 }
 
-optional<Move> CsaAdapter::next(Position const &p, Color next, deque<Move> const &moves, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+optional<Move> CsaAdapter::next(Position const &p, Color next, deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) {
   if (!color_) {
     return nullopt;
   }
   for (size_t i = this->moves.size(); i < moves.size(); i++) {
-    Move m = moves[i];
+    Move m = MoveFromPackedMove(moves[i]);
     if (m.color == OpponentColor(*color_)) {
       string line;
       if (m.color == Color::Black) {
@@ -361,7 +361,7 @@ optional<Move> CsaAdapter::next(Position const &p, Color next, deque<Move> const
   }
   optional<Move> mv;
   if (this->moves.size() == moves.size() + 1 && !stopSignal && !result) {
-    mv = this->moves.back();
+    mv = MoveFromPackedMove(this->moves.back());
   }
   lock.unlock();
   return mv;
@@ -567,7 +567,7 @@ optional<Game> CsaPositionReceiver::validate() const {
     if (found == box_.end()) {
       return nullopt;
     }
-    g.handBlack.push_back(it);
+    g.handBlack.add(it);
     box_.erase(found);
   }
   for (auto const &it : handWhite) {
@@ -575,7 +575,7 @@ optional<Game> CsaPositionReceiver::validate() const {
     if (found == box_.end()) {
       return nullopt;
     }
-    g.handWhite.push_back(it);
+    g.handWhite.add(it);
     box_.erase(found);
   }
   if (blackAL && whiteAL) {
@@ -583,13 +583,14 @@ optional<Game> CsaPositionReceiver::validate() const {
   }
   if (blackAL) {
     for (auto const &it : box_) {
-      g.handBlack.push_back(it);
+      g.handBlack.add(it);
     }
   } else if (whiteAL) {
     for (auto const &it : box_) {
-      g.handWhite.push_back(it);
+      g.handWhite.add(it);
     }
   }
+  g.position.sync(g.handBlack, g.handWhite, g.first);
   return g;
 }
 
@@ -128,7 +128,7 @@ struct Match {
           auto mv = get<Move>(ret);
           switch (game.apply(mv)) {
           case Game::ApplyResult::Ok:
-            game.moves.push_back(mv);
+            game.moves.push_back(PackedMoveFromMove(mv));
             sendBoth(msg + "," + seconds());
             update();
             break;
@@ -211,14 +211,14 @@ struct Match {
     }
     {
       string line = "P+";
-      for (auto p : game.handBlack) {
+      for (PieceType p : game.handBlack.pieces()) {
         line += "00" + *CsaStringFromPiece(static_cast<PieceUnderlyingType>(p), 0);
       }
       sendBoth(line);
     }
     {
       string line = "P-";
-      for (auto p : game.handWhite) {
+      for (PieceType p : game.handWhite.pieces()) {
         line += "00" + *CsaStringFromPiece(static_cast<PieceUnderlyingType>(p), 0);
       }
       sendBoth(line);
@@ -12,35 +12,36 @@ Game::ApplyResult Game::apply(Move const &mv) {
       // 二手指し(手番間違い)
       return ApplyResult::Illegal;
     }
-    history[position] = 1;
+    history[position.hash] = 1;
   } else {
-    if (moves.back().color == mv.color) {
+    if (MoveFromPackedMove(moves.back()).color == mv.color) {
       // 二手指し
       return ApplyResult::Illegal;
     }
   }
-  if (!position.apply(mv, handBlack, handWhite)) {
+  if (!position.isApplicable(mv, hand(mv.color))) {
     return ApplyResult::Illegal;
   }
-  auto opponent = OpponentColor(mv.color);
-  if (position.isInCheck(opponent) && !mv.from && mv.piece == MakePiece(mv.color, PieceType::Pawn)) {
-    // 打ち歩による王手. 打ち歩詰めになっていないか確かめる
-    deque<Move> mvs;
-    Generate(position, opponent, handBlack, handWhite, mvs, false);
-    if (mvs.empty()) {
-      // 打ち歩詰め
-      return ApplyResult::Illegal;
-    }
+  bool pawnDropMate = false;
+  if (!mv.from && mv.piece == MakePiece(mv.color, PieceType::Pawn)) {
+    int to = IndexFromSquare(mv.to);
+    int king = position.kingSquare[ColorIndex(OpponentColor(mv.color))];
+    pawnDropMate = king >= 0 && StepAttacks(mv.piece, to).test(king) && position.isPawnDropMate(to, mv.color);
+  }
+  // 王手放置と打ち歩詰めは, 指した後の局面のまま Illegal を返す
+  position.doMove(mv, handBlack, handWhite);
+  if (position.isInCheck(mv.color) || pawnDropMate) {
+    return ApplyResult::Illegal;
   }
   if (position.isInCheck(OpponentColor(mv.color))) {
     if (mv.color == Color::Black) {
-      blackCheckHistory[position] += 1;
-      if (blackCheckHistory[position] >= 4) {
+      blackCheckHistory[position.hash] += 1;
+      if (blackCheckHistory[position.hash] >= 4) {
         return ApplyResult::CheckRepetitionBlack;
       }
     } else {
-      whiteCheckHistory[position] += 1;
-      if (whiteCheckHistory[position] >= 4) {
+      whiteCheckHistory[position.hash] += 1;
+      if (whiteCheckHistory[position.hash] >= 4) {
         return ApplyResult::CheckRepetitionWhite;
       }
     }
@@ -51,186 +52,276 @@ Game::ApplyResult Game::apply(Move const &mv) {
       whiteCheckHistory.clear();
     }
   }
-  history[position] += 1;
-  size_t count = history[position];
+  history[position.hash] += 1;
+  size_t count = history[position.hash];
   if (count >= 4) {
     return ApplyResult::Repetition;
   }
   return ApplyResult::Ok;
 }
 
-void Game::Generate(Position const &position,
-                    Color color,
-                    deque<PieceType> const &handBlack,
-                    deque<PieceType> const &handWhite,
-                    deque<Move> &moves,
-                    bool enablePawnCheckByDrop) {
-  // 非合法手を含めた全ての手
-  deque<Move> all;
+namespace {
 
-  // 駒打ち
-  set<PieceType> hand;
-  for (PieceType const &h : (color == Color::Black ? handBlack : handWhite)) {
-    hand.insert(h);
+// 生成する手の種類
+enum class GenerateType {
+  All,
+  Captures, // 駒を取る手
+  Checks,   // 王手になる手
+  Evasions, // 王手を回避する手. 王手が掛かっていなければ生成しない
+};
+
+// 手番 C の合法手のうち T の種類の手を生成する. 手番に依存する値はコンパイル時に決まる.
+template <Color C, GenerateType T>
+void GenerateMoves(Position const &position, Hand const &hand, MoveList &moves, bool enablePawnCheckByDrop) {
+  constexpr Color opponent = OpponentColor(C);
+  // 先手から見て 1 段目, 2 段目, 1~3 段目にあたる段. 後手の場合は 9 段目, 8 段目, 7~9 段目.
+  constexpr Bitboard farthest = RankBitboard(C == Color::Black ? Rank::Rank1 : Rank::Rank9);
+  constexpr Bitboard second = RankBitboard(C == Color::Black ? Rank::Rank2 : Rank::Rank8);
+  constexpr Bitboard promotionZone = farthest | second | RankBitboard(C == Color::Black ? Rank::Rank3 : Rank::Rank7);
+
+  Bitboard const occupied = position.all();
+  Bitboard const own = position.occupied[ColorIndex(C)];
+  Bitboard const enemy = position.occupied[ColorIndex(opponent)];
+  Bitboard const empty = ~occupied;
+
+  int const king = position.kingSquare[ColorIndex(C)];
+  int const enemyKing = position.kingSquare[ColorIndex(opponent)];
+  if (T == GenerateType::Checks && enemyKing < 0) {
+    return;
   }
-  for (PieceType const &h : hand) {
+  // 動かすと開き王手になる駒
+  Bitboard const discoverers = T == GenerateType::Checks ? position.blockers<opponent>() & own : Bitboard();
+  // 駒 p を置くと相手玉に王手となるマス. 相手の駒を相手玉の位置に置いた時の利きと同じ.
+  auto checkSquares = [&](Piece p, Bitboard const &occ) {
+    return Attacks(RemoveColorFromPiece(p) | static_cast<PieceUnderlyingType>(opponent), enemyKing, occ);
+  };
+
+  // 玉以外の駒を動かす手の移動先, 駒打ちの打ち先として王手放置にならないマス.
+  Bitboard moveTargets = ~own;
+  Bitboard dropTargets = empty;
+  Bitboard pinned;
+  if (king >= 0) {
+    Bitboard checkers = position.attackers<opponent>(king, occupied);
+    if (checkers.count() > 1) {
+      // 両王手. 玉を動かすしかない
+      moveTargets = dropTargets = Bitboard();
+    } else if (checkers) {
+      // 王手している駒を取るか, 間に合駒する
+      Bitboard between = BetweenBitboard(king, checkers.lsb());
+      moveTargets = between | checkers;
+      dropTargets = between;
+    }
+    pinned = position.pinned<C>();
+    if (T == GenerateType::Evasions && !checkers) {
+      return;
+    }
+  } else if (T == GenerateType::Evasions) {
+    return;
+  }
+  if (T == GenerateType::Captures) {
+    moveTargets &= enemy;
+    dropTargets = Bitboard();
+  }
+
+  // 駒打ち
+  for (PieceType h : Hand::kTypes) {
+    if (!dropTargets) {
+      break;
+    }
+    if (!hand.contains(h)) {
+      continue;
+    }
+    Piece const piece = MakePiece(C, h);
+    Bitboard targets = dropTargets;
+    if (T == GenerateType::Checks) {
+      targets &= checkSquares(piece, occupied);
+    }
     if (h == PieceType::Pawn) {
-      // 二歩と打ち歩詰め
-      Rank minY, maxY;
-      if (color == Color::Black) {
-        minY = Rank::Rank2;
-        maxY = Rank::Rank9;
-      } else {
-        minY = Rank::Rank1;
-        maxY = Rank::Rank8;
-      }
-      for (int y = minY; y <= maxY; y++) {
-        for (int x = 0; x < 9; x++) {
-          Piece p = position.pieces[x][y];
-          if (p != 0) {
-            continue;
-          }
-          int numPawn = 0;
-          for (int i = 0; i < 9; i++) {
-            if (position.pieces[x][i] == 0) {
-              continue;
-            }
-            if (position.pieces[x][i] == MakePiece(color, PieceType::Pawn)) {
-              numPawn++;
-            }
-          }
-          if (numPawn == 0) {
-            Move m;
-            m.color = color;
-            m.to = MakeSquare(x, y);
-            m.piece = MakePiece(color, PieceType::Pawn);
-            if (enablePawnCheckByDrop) {
-              all.push_back(m);
-            } else {
-              int dy = color == Color::Black ? -1 : 1;
-              Piece pp = position.pieces[x][y + dy];
-              if (!(ColorFromPiece(pp) != color && PieceTypeFromPiece(pp) == PieceType::King)) {
-                all.push_back(m);
-              }
-            }
-          }
-        }
+      targets = targets.andNot(farthest);
+      // 二歩
+      Bitboard pawns = position.types[static_cast<PieceUnderlyingType>(PieceType::Pawn)].andNot(position.promoted) & own;
+      while (pawns) {
+        targets = targets.andNot(FileBitboard(pawns.pop() / 9));
       }
-    } else {
-      Rank minY, maxY;
-      if (h == PieceType::Lance) {
-        if (color == Color::Black) {
-          minY = Rank::Rank2;
-          maxY = Rank::Rank9;
-        } else {
-          minY = Rank::Rank1;
-          maxY = Rank::Rank8;
-        }
-      } else if (h == PieceType::Knight) {
-        if (color == Color::Black) {
-          minY = Rank::Rank3;
-          maxY = Rank::Rank9;
-        } else {
-          minY = Rank::Rank1;
-          maxY = Rank::Rank7;
-        }
-      } else {
-        minY = Rank::Rank1;
-        maxY = Rank::Rank9;
-      }
-      for (int y = minY; y <= maxY; y++) {
-        for (int x = 0; x < 9; x++) {
-          Piece p = position.pieces[x][y];
-          if (p != 0) {
-            continue;
-          }
-          Move m;
-          m.color = color;
-          m.to = MakeSquare(x, y);
-          m.piece = MakePiece(color, h);
-          all.push_back(m);
-        }
+      // 打ち歩による王手
+      Bitboard check = enemyKing >= 0 ? StepAttacks(MakePiece(opponent, PieceType::Pawn), enemyKing) & targets : Bitboard();
+      if (check && (!enablePawnCheckByDrop || position.isPawnDropMate(check.lsb(), C))) {
+        // 打ち歩詰め
+        targets = targets.andNot(check);
       }
+    } else if (h == PieceType::Lance) {
+      targets = targets.andNot(farthest);
+    } else if (h == PieceType::Knight) {
+      targets = targets.andNot(farthest | second);
+    }
+    while (targets) {
+      Move m;
+      m.color = C;
+      m.to = SquareFromIndex(targets.pop());
+      m.piece = piece;
+      moves.push_back(m);
     }
   }
 
   // 駒の移動
-  for (int y = 0; y < 9; y++) {
-    for (int x = 0; x < 9; x++) {
-      Piece p = position.pieces[x][y];
-      if (p == 0) {
-        continue;
+  Bitboard froms = own;
+  while (froms) {
+    int f = froms.pop();
+    Piece p = position.at(f);
+    Square from = SquareFromIndex(f);
+    Bitboard targets = Attacks(p, f, occupied).andNot(own);
+    if (f == king) {
+      // 移動先に相手の駒が利いていないこと. 玉が居たマスの先に利く走り駒もあるので, 玉を除いた盤面で調べる.
+      Bitboard occ = occupied;
+      occ.reset(king);
+      if (T == GenerateType::Captures) {
+        targets &= enemy;
       }
-      if (ColorFromPiece(p) != color) {
-        continue;
-      }
-      Square from = MakeSquare(x, y);
-      for (int i = 0; i < 9; i++) {
-        for (int j = 0; j < 9; j++) {
-          if (i == x && j == y) {
-            continue;
-          }
-          Piece p1 = position.pieces[i][j];
-          if (p1 != 0 && ColorFromPiece(p1) == color) {
-            continue;
-          }
-          Square to = MakeSquare(i, j);
-          if (!Move::CanMove(position, from, to)) {
-            continue;
-          }
-          Move m;
-          m.color = color;
-          m.piece = p;
-          m.from = from;
-          m.to = to;
-          if (p1 != 0) {
-            m.captured = RemoveColorFromPiece(p1);
-          }
-          if (CanPromote(p) && IsPromotableMove(from, to, color)) {
-            // 成
-            Move mp = m;
-            mp.promote = 1;
-            all.push_back(mp);
-            if (!MustPromote(PieceTypeFromPiece(p), from, to, color)) {
-              // 不成
-              Move mnp = m;
-              mnp.promote = -1;
-              all.push_back(mnp);
-            }
-          } else {
-            all.push_back(m);
-          }
+      Bitboard safe;
+      while (targets) {
+        int t = targets.pop();
+        if (!position.attackers<opponent>(t, occ)) {
+          safe.set(t);
         }
       }
+      targets = safe;
+    } else {
+      targets &= moveTargets;
+      if (pinned.test(f)) {
+        // ピンされた駒は玉との直線上しか動けない
+        targets &= LineBitboard(king, f);
+      }
     }
-  }
-
-  // 自玉に王手が掛かったままになる手を除外する
-  for (int i = (int)all.size() - 1; i >= 0; i--) {
-    Move mv = all[i];
-    Position cp = position;
-    deque<PieceType> hb = handBlack;
-    deque<PieceType> hw = handWhite;
-    if (!cp.apply(mv, hb, hw)) {
-      all.erase(all.begin() + i);
-      continue;
+    // 成れる手の移動先と, 成らないと反則になる移動先
+    Bitboard promotable;
+    Bitboard mustPromote;
+    if (CanPromote(p)) {
+      promotable = promotionZone.test(f) ? targets : targets & promotionZone;
+      PieceType type = PieceTypeFromPiece(p);
+      if (type == PieceType::Pawn || type == PieceType::Lance) {
+        mustPromote = targets & farthest;
+      } else if (type == PieceType::Knight) {
+        mustPromote = targets & (farthest | second);
+      }
     }
-    if (cp.isInCheck(color)) {
-      all.erase(all.begin() + i);
-      continue;
+    // 成らずに指して王手になる移動先と, 成って王手になる移動先
+    Bitboard checks;
+    Bitboard promotedChecks;
+    if (T == GenerateType::Checks) {
+      if (discoverers.test(f)) {
+        // 相手玉との直線から外れると開き王手
+        checks = promotedChecks = targets.andNot(LineBitboard(enemyKing, f));
+      }
+      if (f != king) {
+        Bitboard occ = occupied;
+        occ.reset(f);
+        checks |= checkSquares(p, occ);
+        if (promotable) {
+          promotedChecks |= checkSquares(Promote(p), occ) & promotable;
+        }
+      }
+      targets &= checks | promotedChecks;
     }
-    // 打ち歩詰めになっていないか確認する
-    int dy = color == Color::Black ? -1 : 1;
-    if (!mv.from && PieceTypeFromPiece(mv.piece) == PieceType::Pawn && ColorFromPiece(cp.pieces[mv.to.file][mv.to.rank + dy]) != color && PieceTypeFromPiece(cp.pieces[mv.to.file][mv.to.rank + dy]) == PieceType::King) {
-      // 打ち歩による王手
-      deque<Move> next;
-      Generate(cp, color == Color::Black ? Color::White : Color::Black, hb, hw, next, false);
-      if (next.empty()) {
-        all.erase(all.begin() + i);
+    while (targets) {
+      int t = targets.pop();
+      Piece p1 = position.at(t);
+      Move m;
+      m.color = C;
+      m.piece = p;
+      m.from = from;
+      m.to = SquareFromIndex(t);
+      if (p1 != 0) {
+        m.captured = RemoveColorFromPiece(p1);
+      }
+      if (promotable.test(t)) {
+        if (T != GenerateType::Checks || promotedChecks.test(t)) {
+          // 成
+          Move mp = m;
+          mp.promote = 1;
+          moves.push_back(mp);
+        }
+        if (!mustPromote.test(t) && (T != GenerateType::Checks || checks.test(t))) {
+          // 不成
+          Move mnp = m;
+          mnp.promote = -1;
+          moves.push_back(mnp);
+        }
+      } else {
+        moves.push_back(m);
       }
     }
   }
-  moves.swap(all);
+}
+
+} // namespace
+
+void Game::Generate(Position const &position,
+                    Color color,
+                    Hand const &handBlack,
+                    Hand const &handWhite,
+                    MoveList &moves,
+                    bool enablePawnCheckByDrop) {
+  moves.clear();
+  if (color == Color::Black) {
+    GenerateMoves<Color::Black, GenerateType::All>(position, handBlack, moves, enablePawnCheckByDrop);
+  } else {
+    GenerateMoves<Color::White, GenerateType::All>(position, handWhite, moves, enablePawnCheckByDrop);
+  }
+}
+
+void Game::GenerateCaptures(Position const &position, Color color, MoveList &moves) {
+  moves.clear();
+  // 駒を取る手に駒打ちは無いので持ち駒は参照しない
+  Hand hand;
+  if (color == Color::Black) {
+    GenerateMoves<Color::Black, GenerateType::Captures>(position, hand, moves, true);
+  } else {
+    GenerateMoves<Color::White, GenerateType::Captures>(position, hand, moves, true);
+  }
+}
+
+void Game::GenerateChecks(Position const &position,
+                          Color color,
+                          Hand const &handBlack,
+                          Hand const &handWhite,
+                          MoveList &moves,
+                          bool enablePawnCheckByDrop) {
+  moves.clear();
+  if (color == Color::Black) {
+    GenerateMoves<Color::Black, GenerateType::Checks>(position, handBlack, moves, enablePawnCheckByDrop);
+  } else {
+    GenerateMoves<Color::White, GenerateType::Checks>(position, handWhite, moves, enablePawnCheckByDrop);
+  }
+}
+
+void Game::GenerateEvasions(Position const &position,
+                            Color color,
+                            Hand const &handBlack,
+                            Hand const &handWhite,
+                            MoveList &moves,
+                            bool enablePawnCheckByDrop) {
+  moves.clear();
+  if (color == Color::Black) {
+    GenerateMoves<Color::Black, GenerateType::Evasions>(position, handBlack, moves, enablePawnCheckByDrop);
+  } else {
+    GenerateMoves<Color::White, GenerateType::Evasions>(position, handWhite, moves, enablePawnCheckByDrop);
+  }
+}
+
+void Game::Generate(Position const &position,
+                    Color color,
+                    Hand const &handBlack,
+                    Hand const &handWhite,
+                    deque<Move> &moves,
+                    bool enablePawnCheckByDrop) {
+  MoveList list;
+  Generate(position, color, handBlack, handWhite, list, enablePawnCheckByDrop);
+  moves.assign(list.begin(), list.end());
+}
+
+void Game::generate(MoveList &moves) const {
+  Color color = next();
+  Generate(position, color, handBlack, handWhite, moves, true);
 }
 
 void Game::generate(deque<Move> &moves) const {
@@ -238,4 +329,33 @@ void Game::generate(deque<Move> &moves) const {
   Generate(position, color, handBlack, handWhite, moves, true);
 }
 
+void LegalMoveSet::reset(Position const &p, Color color, Hand const &handBlack, Hand const &handWhite) {
+  slots.fill(0);
+  size_ = 0;
+  MoveList moves;
+  Game::Generate(p, color, handBlack, handWhite, moves, true);
+  for (Move const &mv : moves) {
+    uint32_t key;
+    if (mv.from) {
+      key = Key(IndexFromSquare(*mv.from), IndexFromSquare(mv.to), PieceType::Empty, mv.promote == 1);
+    } else {
+      key = Key(-1, IndexFromSquare(mv.to), PieceTypeFromPiece(mv.piece), false);
+    }
+    size_t i = Slot(key);
+    while (slots[i] != 0) {
+      i = (i + 1) & (kCapacity - 1);
+    }
+    slots[i] = key;
+    size_++;
+  }
+}
+
+bool LegalMoveSet::contains(Move const &mv) const {
+  if (mv.from) {
+    return contains(*mv.from, mv.to, mv.promote == 1);
+  } else {
+    return containsDrop(PieceTypeFromPiece(mv.piece), mv.to);
+  }
+}
+
 } // namespace sci
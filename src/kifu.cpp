@@ -0,0 +1,217 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace sci {
+
+namespace {
+
+u8string const kNewLine = u8"\r\n";
+
+u8string U8StringFromNumber(size_t n) {
+  string s = to_string(n);
+  return u8string((char8_t const *)s.c_str(), s.size());
+}
+
+u8string HeaderString(KifuHeader const &header, KifuFormat format) {
+  u8string ret;
+  if (header.startDateTime) {
+    ret += u8"開始日時：" + *header.startDateTime + kNewLine;
+  }
+  if (header.endDateTime) {
+    ret += u8"終了日時：" + *header.endDateTime + kNewLine;
+  }
+  if (auto handicap = KifStringFromHandicap(header.handicap); handicap) {
+    if (header.handicapHand) {
+      ret += u8"手合割：その他" + kNewLine;
+      ret += u8"#" + *handicap + u8"(駒渡し)" + kNewLine;
+    } else {
+      ret += u8"手合割：" + *handicap + kNewLine;
+    }
+  } else {
+    ret += u8"手合割：その他" + kNewLine;
+    ret += u8"#" + StringFromHandicap(header.handicap) + (header.handicapHand ? u8"(駒渡し)" : u8"") + kNewLine;
+  }
+  ret += u8"先手：" + header.black + kNewLine;
+  ret += u8"後手：" + header.white + kNewLine;
+  if (format == KifuFormat::Kif) {
+    ret += u8"手数----指手---------消費時間--" + kNewLine;
+  }
+  return ret;
+}
+
+template <class OutputIt>
+OutputIt FormatNumberTo(OutputIt out, size_t n) {
+  char buffer[20];
+  char *end = to_chars(buffer, buffer + sizeof(buffer), n).ptr;
+  return copy(buffer, end, out);
+}
+
+// ply 手目の指し手の行
+template <class OutputIt>
+OutputIt FormatMoveLineTo(OutputIt out, KifuFormat format, size_t ply, Move const &mv, optional<Square> last) {
+  if (format == KifuFormat::Kif) {
+    out = FormatNumberTo(out, ply);
+    *out++ = u8' ';
+    out = FormatKifMoveTo(out, mv, last);
+  } else {
+    out = FormatKi2MoveTo(out, mv, last);
+  }
+  return FormatTo(out, kNewLine);
+}
+
+// ply 手まで指して終局した時の, 終局の理由と勝敗の行
+u8string ResultLines(KifuFormat format, Status::Result const &result, size_t ply) {
+  u8string ret;
+  if (format == KifuFormat::Kif) {
+    u8string next = U8StringFromNumber(ply + 1);
+    switch (result.reason) {
+    case GameResultReason::Resign:
+      ret += next + u8" 投了" + kNewLine;
+      break;
+    case GameResultReason::Repetition:
+    case GameResultReason::CheckRepetition:
+      ret += next + u8" 千日手" + kNewLine;
+      break;
+    case GameResultReason::IllegalAction:
+      ret += next + u8" 反則負け" + kNewLine;
+      break;
+    case GameResultReason::Abort:
+      break;
+    }
+    switch (result.result) {
+    case GameResult::BlackWin:
+      ret += u8"まで" + U8StringFromNumber(ply) + u8"手で先手の勝ち" + kNewLine;
+      break;
+    case GameResult::WhiteWin:
+      ret += u8"まで" + U8StringFromNumber(ply) + u8"手で後手の勝ち" + kNewLine;
+      break;
+    case GameResult::Abort:
+      ret += next + u8" 中断" + kNewLine;
+      break;
+    }
+  } else {
+    switch (result.result) {
+    case GameResult::BlackWin:
+      ret += u8"まで" + U8StringFromNumber(ply) + u8"手で先手の勝ち" + kNewLine;
+      break;
+    case GameResult::WhiteWin:
+      ret += u8"まで" + U8StringFromNumber(ply) + u8"手で後手の勝ち" + kNewLine;
+      break;
+    case GameResult::Abort:
+      if (result.reason == GameResultReason::Repetition || result.reason == GameResultReason::CheckRepetition) {
+        ret += u8"まで" + U8StringFromNumber(ply) + u8"手で千日手" + kNewLine;
+      } else {
+        ret += u8"まで" + U8StringFromNumber(ply) + u8"手で中断" + kNewLine;
+      }
+      break;
+    }
+  }
+  return ret;
+}
+
+} // namespace
+
+u8string KifStringFromMove(Move const &mv, optional<Square> last) {
+  MoveStringBuffer buffer;
+  FormatKifMoveTo(back_inserter(buffer), mv, last);
+  return u8string(buffer.view());
+}
+
+u8string Ki2StringFromMove(Move const &mv, optional<Square> last) {
+  MoveStringBuffer buffer;
+  FormatKi2MoveTo(back_inserter(buffer), mv, last);
+  return u8string(buffer.view());
+}
+
+u8string KifuStringFromGame(Game const &game, KifuHeader const &header, optional<Status::Result> result, KifuFormat format) {
+  u8string ret = HeaderString(header, format);
+  optional<Square> last;
+  // 1 手あたり 30 バイト程度
+  ret.reserve(ret.size() + game.moves.size() * 32 + 128);
+  auto out = back_inserter(ret);
+  for (size_t i = 0; i < game.moves.size(); i++) {
+    Move mv = MoveFromPackedMove(game.moves[i]);
+    out = FormatMoveLineTo(out, format, i + 1, mv, last);
+    last = mv.to;
+  }
+  if (result) {
+    ret += ResultLines(format, *result, game.moves.size());
+  }
+  return ret;
+}
+
+bool KifuWriter::open(string const &path, KifuHeader const &header) {
+  close();
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    cout << "棋譜ファイルを開けなかった: " << path << endl;
+    return false;
+  }
+  ply_ = 0;
+  last = nullopt;
+  return write(HeaderString(header, format)) && sync();
+}
+
+bool KifuWriter::append(Move const &mv) {
+  if (fd < 0) {
+    return false;
+  }
+  ply_++;
+  MoveStringBuffer line;
+  FormatMoveLineTo(back_inserter(line), format, ply_, mv, last);
+  bool ok = write(line.view());
+  last = mv.to;
+  if (++unsynced >= kSyncInterval) {
+    ok = sync() && ok;
+  }
+  return ok;
+}
+
+bool KifuWriter::finish(Status::Result const &result) {
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(ResultLines(format, result, ply_)) && sync();
+  close();
+  return ok;
+}
+
+void KifuWriter::close() {
+  if (fd < 0) {
+    return;
+  }
+  sync();
+  ::close(fd);
+  fd = -1;
+}
+
+bool KifuWriter::write(u8string_view lines) {
+  // 1 行ずつすぐに書き込むので, 途中でアプリが落ちても書き込んだ所までは残る
+  char const *p = (char const *)lines.data();
+  size_t remaining = lines.size();
+  while (remaining > 0) {
+    ssize_t n = ::write(fd, p, remaining);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    remaining -= n;
+  }
+  return true;
+}
+
+bool KifuWriter::sync() {
+  unsynced = 0;
+  return ::fsync(fd) == 0;
+}
+
+} // namespace sci
@@ -0,0 +1,739 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace sci {
+
+namespace {
+
+// 1 局分の指し手としてあらかじめ確保しておく数
+size_t const kReserveMoves = 256;
+
+bool Consume(u8string_view &s, u8string_view prefix) {
+  if (s.starts_with(prefix)) {
+    s.remove_prefix(prefix.size());
+    return true;
+  }
+  return false;
+}
+
+void TrimSpaces(u8string_view &s) {
+  while (Consume(s, u8" ") || Consume(s, u8"\t") || Consume(s, u8"　")) {
+  }
+}
+
+// 先頭の算用数字 1 文字. 無ければ -1
+int ConsumeDigit(u8string_view &s) {
+  if (s.empty() || s[0] < u8'0' || u8'9' < s[0]) {
+    return -1;
+  }
+  int ret = s[0] - u8'0';
+  s.remove_prefix(1);
+  return ret;
+}
+
+optional<Square> ConsumeSquare(u8string_view &s) {
+  size_t offset = 0;
+  auto ret = ParseSquare(s, offset);
+  s.remove_prefix(offset);
+  return ret;
+}
+
+optional<PieceUnderlyingType> ConsumePiece(u8string_view &s) {
+  size_t offset = 0;
+  auto ret = ParsePieceTypeAndStatus(s, offset);
+  s.remove_prefix(offset);
+  return ret;
+}
+
+// 手合割の名前. KIF の "手合割：" の値と, StringFromHandicap の表記のどちらも読む.
+optional<Handicap> HandicapFromName(u8string_view name) {
+  static auto const sTable = [] {
+    vector<pair<u8string, Handicap>> t;
+    for (size_t i = 0; i < kHandicapPositions.size(); i++) {
+      Handicap h = static_cast<Handicap>(i);
+      if (auto kif = KifStringFromHandicap(h); kif) {
+        t.emplace_back(*kif, h);
+      }
+      t.emplace_back(StringFromHandicap(h), h);
+    }
+    return t;
+  }();
+  for (auto const &[s, h] : sTable) {
+    if (s == name) {
+      return h;
+    }
+  }
+  return nullopt;
+}
+
+// 1 局の終わりを表す KIF の指し手
+bool IsTerminalWord(u8string_view s) {
+  for (u8string_view word : {u8"投了", u8"中断", u8"千日手", u8"詰み", u8"持将棋", u8"切れ負け", u8"反則勝ち", u8"反則負け", u8"入玉勝ち", u8"不戦勝", u8"不戦敗"}) {
+    if (s.starts_with(word)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 1 行ずつ読んで, 1 局分読み終えたら callback に渡す.
+class Parser {
+public:
+  explicit Parser(function<void(KifuRecord &&)> const &callback) : callback(callback) {
+    reset();
+  }
+
+  void line(u8string_view s);
+  // 読み終えていない棋譜があれば callback に渡す.
+  void flush();
+
+  size_t count = 0;
+
+private:
+  void reset();
+  // 棋譜の情報の行を読む前に呼ぶ. 既に指し手を読んでいれば, 新しい棋譜が始まったとみなす.
+  void beginHeader();
+  // 指し手の行を読む前に呼ぶ. 読み飛ばす場合は false.
+  bool beginMoves();
+  void setHandicap(Handicap h, bool hand);
+  void fail(u8string_view message);
+
+  void header(u8string_view key, u8string_view value);
+  void csa(u8string_view s);
+  void csaPosition(u8string_view s);
+  bool resolveCsaPosition();
+  void kif(u8string_view s);
+  void ki2(u8string_view s);
+  // KI2 形式の指し手から, 動かした駒を特定する.
+  optional<Move> resolve(Square to, PieceUnderlyingType type, Suffix suffix, int promote) const;
+  void push(Move const &mv);
+
+  function<void(KifuRecord &&)> const &callback;
+  KifuRecord record;
+  size_t lineNumber = 0;
+  // この棋譜の行を 1 行でも読んだ
+  bool touched = false;
+  // 指し手の行を読み始めた
+  bool started = false;
+  // 終局した, 変化に入った, 読み取れなかったなどの理由で, 次の棋譜まで指し手を読み飛ばす
+  bool ended = false;
+  // "手合割：その他" の後の "#香落ち" のようなコメントで手合割を指定する
+  bool handicapComment = false;
+  // 盤面図から始まる棋譜
+  bool boardDiagram = false;
+
+  Position position;
+  Hand handBlack;
+  Hand handWhite;
+  Color next = Color::Black;
+  optional<Square> last;
+
+  // CSA 形式の開始局面. 最初の指し手の前に, どの手合割なのかを調べる.
+  bool csaBoard = false;
+  Piece board[9][9];
+  Hand csaHandBlack;
+  bool csaHandWhite = false;
+};
+
+void Parser::reset() {
+  record = KifuRecord();
+  record.game.moves.reserve(kReserveMoves);
+  touched = false;
+  started = false;
+  ended = false;
+  handicapComment = false;
+  boardDiagram = false;
+  csaBoard = false;
+  csaHandBlack = Hand();
+  csaHandWhite = false;
+  setHandicap(Handicap::平手, false);
+}
+
+void Parser::flush() {
+  if (csaBoard && !ended) {
+    resolveCsaPosition();
+  }
+  if (touched) {
+    callback(std::move(record));
+    count++;
+  }
+  reset();
+}
+
+void Parser::beginHeader() {
+  if (started) {
+    flush();
+  }
+  touched = true;
+}
+
+bool Parser::beginMoves() {
+  touched = true;
+  started = true;
+  if (ended) {
+    return false;
+  }
+  if (handicapComment) {
+    fail(u8"未対応の手合割です");
+    return false;
+  }
+  if (boardDiagram) {
+    fail(u8"盤面図から始まる棋譜には対応していません");
+    return false;
+  }
+  if (csaBoard && !resolveCsaPosition()) {
+    return false;
+  }
+  return true;
+}
+
+void Parser::setHandicap(Handicap h, bool hand) {
+  record.game.handicap = h;
+  record.game.handicapHand = hand;
+  handBlack = Hand();
+  handWhite = Hand();
+  // Game::reset と同じ開始局面にする
+  position = MakePosition(h, hand ? &handBlack : nullptr);
+  next = h == Handicap::平手 ? Color::Black : Color::White;
+  position.syncHand(handBlack, handWhite, next);
+  position.enableAttackMap();
+  last = nullopt;
+}
+
+void Parser::fail(u8string_view message) {
+  if (!record.error) {
+    record.error = u8string(message);
+    record.line = lineNumber;
+  }
+  ended = true;
+  started = true;
+  touched = true;
+}
+
+void Parser::line(u8string_view s) {
+  lineNumber++;
+  if (s.ends_with(u8"\r")) {
+    s.remove_suffix(1);
+  }
+  if (s.empty()) {
+    return;
+  }
+  switch (s[0]) {
+  case u8'\'': // CSA のコメント
+  case u8'*':  // KIF のコメント
+  case u8'&':  // KIF のしおり
+  case u8'T':  // CSA の消費時間
+    return;
+  case u8'#':
+    if (handicapComment) {
+      s.remove_prefix(1);
+      bool hand = false;
+      if (s.ends_with(u8"(駒渡し)")) {
+        s.remove_suffix(u8string_view(u8"(駒渡し)").size());
+        hand = true;
+      }
+      if (auto h = HandicapFromName(s); h) {
+        handicapComment = false;
+        setHandicap(*h, hand);
+      }
+    }
+    return;
+  case u8'/':
+    // CSA の棋譜の区切り
+    flush();
+    return;
+  case u8'V':
+  case u8'N':
+  case u8'$':
+    beginHeader();
+    return;
+  case u8'P':
+    beginHeader();
+    csaPosition(s);
+    return;
+  case u8'+':
+  case u8'-':
+    if (s.size() == 1) {
+      // CSA の手番
+      return;
+    }
+    if (s[1] == u8'-') {
+      // 盤面図の枠
+      beginHeader();
+      boardDiagram = true;
+      return;
+    }
+    csa(s);
+    return;
+  case u8'|':
+    boardDiagram = true;
+    return;
+  case u8'%':
+    if (beginMoves()) {
+      ended = true;
+    }
+    return;
+  default:
+    break;
+  }
+  TrimSpaces(s);
+  if (s.empty()) {
+    return;
+  }
+  if (u8'0' <= s[0] && s[0] <= u8'9') {
+    kif(s);
+    return;
+  }
+  if (s.starts_with(u8"▲") || s.starts_with(u8"△") || s.starts_with(u8"☗") || s.starts_with(u8"☖")) {
+    ki2(s);
+    return;
+  }
+  if (s.starts_with(u8"変化：")) {
+    // 本譜以外の手順は読まない
+    ended = true;
+    return;
+  }
+  if (s.starts_with(u8"まで") || s.starts_with(u8"手数")) {
+    return;
+  }
+  if (auto colon = s.find(u8"："); colon != u8string_view::npos) {
+    header(s.substr(0, colon), s.substr(colon + u8string_view(u8"：").size()));
+  }
+}
+
+void Parser::header(u8string_view key, u8string_view value) {
+  beginHeader();
+  TrimSpaces(value);
+  if (key == u8"手合割") {
+    if (value == u8"その他") {
+      handicapComment = true;
+    } else if (auto h = HandicapFromName(value); h) {
+      setHandicap(*h, false);
+    } else {
+      fail(u8"未対応の手合割です");
+    }
+  } else if (key == u8"先手の持駒" || key == u8"後手の持駒" || key == u8"下手の持駒" || key == u8"上手の持駒") {
+    boardDiagram = true;
+  }
+}
+
+void Parser::csa(u8string_view s) {
+  // "+7776FU,T12" のように 1 行に複数書いてある場合がある
+  while (!s.empty()) {
+    auto comma = s.find(u8',');
+    u8string_view item = s.substr(0, comma);
+    s = comma == u8string_view::npos ? u8string_view() : s.substr(comma + 1);
+    if (item.empty() || (item[0] != u8'+' && item[0] != u8'-')) {
+      continue;
+    }
+    if (!beginMoves()) {
+      return;
+    }
+    auto mv = MoveFromCsaMove(string_view((char const *)item.data(), item.size()), position);
+    if (auto error = get_if<u8string>(&mv); error) {
+      fail(*error);
+      return;
+    }
+    if (get<Move>(mv).color != next) {
+      fail(u8"手番が違います");
+      return;
+    }
+    push(get<Move>(mv));
+  }
+}
+
+void Parser::csaPosition(u8string_view s) {
+  if (started) {
+    return;
+  }
+  if (!csaBoard) {
+    memcpy(board, kHandicapPositions[static_cast<int>(Handicap::平手)].pieces, sizeof(board));
+    csaBoard = true;
+  }
+  auto piece = [](u8string_view s) {
+    return PieceTypeFromCsaString(string_view((char const *)s.data(), 2));
+  };
+  if (s.starts_with(u8"PI")) {
+    // "PI82HI22KA": 平手から駒を落とす
+    for (s.remove_prefix(2); s.size() >= 4; s.remove_prefix(4)) {
+      int file = s[0] - u8'0';
+      int rank = s[1] - u8'0';
+      if (file < 1 || 9 < file || rank < 1 || 9 < rank || !piece(s.substr(2))) {
+        fail(u8"開始局面を読み取れませんでした");
+        return;
+      }
+      board[9 - file][rank - 1] = 0;
+    }
+  } else if (s.size() >= 2 && u8'1' <= s[1] && s[1] <= u8'9') {
+    // "P1-KY-KE-GI-KI-OU-KI-GI-KE-KY": 1 段分の盤面
+    int rank = s[1] - u8'1';
+    s.remove_prefix(2);
+    for (int x = 0; x < 9; x++) {
+      u8string_view cell = s.substr(min<size_t>(3 * x, s.size()), 3);
+      if (cell.size() < 3 || cell == u8" * ") {
+        board[x][rank] = 0;
+        continue;
+      }
+      auto type = piece(cell.substr(1));
+      if ((cell[0] != u8'+' && cell[0] != u8'-') || !type) {
+        fail(u8"開始局面を読み取れませんでした");
+        return;
+      }
+      board[x][rank] = *type | static_cast<PieceUnderlyingType>(cell[0] == u8'+' ? Color::Black : Color::White);
+    }
+  } else if (s.starts_with(u8"P+") || s.starts_with(u8"P-")) {
+    // "P+00KI": 持ち駒
+    bool black = s[1] == u8'+';
+    for (s.remove_prefix(2); s.size() >= 4; s.remove_prefix(4)) {
+      auto type = piece(s.substr(2));
+      if (!s.starts_with(u8"00") || !type || IsPromotedPiece(*type) || PieceTypeFromPiece(*type) == PieceType::King) {
+        fail(u8"開始局面を読み取れませんでした");
+        return;
+      }
+      if (black) {
+        csaHandBlack.add(PieceTypeFromPiece(*type));
+      } else {
+        csaHandWhite = true;
+      }
+    }
+  }
+}
+
+bool Parser::resolveCsaPosition() {
+  csaBoard = false;
+  if (!csaHandWhite) {
+    for (size_t i = 0; i < kHandicapPositions.size(); i++) {
+      auto const &s = kHandicapPositions[i];
+      if (memcmp(board, s.pieces, sizeof(board)) != 0) {
+        continue;
+      }
+      // 先手の持ち駒は, 駒渡しの場合だけ認める
+      if (csaHandBlack.empty() || csaHandBlack == s.removed) {
+        setHandicap(static_cast<Handicap>(i), !csaHandBlack.empty());
+        return true;
+      }
+    }
+  }
+  fail(u8"未対応の開始局面です");
+  return false;
+}
+
+void Parser::kif(u8string_view s) {
+  size_t ply = 0;
+  for (int d; (d = ConsumeDigit(s)) >= 0;) {
+    ply = ply * 10 + d;
+  }
+  if (!beginMoves()) {
+    return;
+  }
+  if (ply != record.game.moves.size() + 1) {
+    fail(u8"手数が合いません");
+    return;
+  }
+  TrimSpaces(s);
+  Square to;
+  if (Consume(s, u8"同")) {
+    TrimSpaces(s);
+    if (!last) {
+      fail(u8"直前の指し手がありません");
+      return;
+    }
+    to = *last;
+  } else if (auto sq = ConsumeSquare(s); sq) {
+    to = *sq;
+  } else if (IsTerminalWord(s)) {
+    ended = true;
+    return;
+  } else {
+    fail(u8"指し手を読み取れませんでした");
+    return;
+  }
+  auto type = ConsumePiece(s);
+  if (!type) {
+    fail(u8"指し手を読み取れませんでした");
+    return;
+  }
+  Move mv;
+  mv.color = next;
+  mv.piece = *type | static_cast<PieceUnderlyingType>(next);
+  mv.to = to;
+  if (Consume(s, u8"成")) {
+    mv.promote = 1;
+  } else if (Consume(s, u8"不成") || Consume(s, u8"生")) {
+    mv.promote = -1;
+  }
+  if (!Consume(s, u8"打")) {
+    // "(77)" のような移動元
+    int file = -1;
+    int rank = -1;
+    if (Consume(s, u8"(")) {
+      file = ConsumeDigit(s);
+      rank = ConsumeDigit(s);
+    }
+    if (file < 1 || rank < 1 || !Consume(s, u8")")) {
+      fail(u8"指し手を読み取れませんでした");
+      return;
+    }
+    mv.from = MakeSquare(9 - file, rank - 1);
+    if (mv.promote == 0 && CanPromote(mv.piece) && IsPromotableMove(*mv.from, to, next)) {
+      mv.promote = -1;
+    }
+  } else if (mv.promote != 0) {
+    fail(u8"指し手を読み取れませんでした");
+    return;
+  }
+  mv.decideSuffix(position);
+  push(mv);
+}
+
+void Parser::ki2(u8string_view s) {
+  // "▲７六歩    △３四歩" のように 1 行に複数書いてある場合がある
+  while (true) {
+    TrimSpaces(s);
+    if (s.empty()) {
+      return;
+    }
+    Color color;
+    if (Consume(s, u8"▲") || Consume(s, u8"☗")) {
+      color = Color::Black;
+    } else if (Consume(s, u8"△") || Consume(s, u8"☖")) {
+      color = Color::White;
+    } else {
+      fail(u8"指し手を読み取れませんでした");
+      return;
+    }
+    if (!beginMoves()) {
+      return;
+    }
+    if (color != next) {
+      fail(u8"手番が違います");
+      return;
+    }
+    Square to;
+    if (Consume(s, u8"同")) {
+      TrimSpaces(s);
+      if (!last) {
+        fail(u8"直前の指し手がありません");
+        return;
+      }
+      to = *last;
+    } else if (auto sq = ConsumeSquare(s); sq) {
+      to = *sq;
+    } else {
+      fail(u8"指し手を読み取れませんでした");
+      return;
+    }
+    auto type = ConsumePiece(s);
+    if (!type) {
+      fail(u8"指し手を読み取れませんでした");
+      return;
+    }
+    Suffix suffix = 0;
+    while (true) {
+      if (Consume(s, u8"右")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Right);
+      } else if (Consume(s, u8"左")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Left);
+      } else if (Consume(s, u8"直")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Nearest);
+      } else if (Consume(s, u8"上") || Consume(s, u8"行") || Consume(s, u8"入")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Up);
+      } else if (Consume(s, u8"引")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Down);
+      } else if (Consume(s, u8"寄")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Sideway);
+      } else if (Consume(s, u8"打")) {
+        suffix |= static_cast<SuffixUnderlyingType>(SuffixType::Drop);
+      } else {
+        break;
+      }
+    }
+    int promote = 0;
+    if (Consume(s, u8"成")) {
+      promote = 1;
+    } else if (Consume(s, u8"不成") || Consume(s, u8"生")) {
+      promote = -1;
+    }
+    auto mv = resolve(to, *type, suffix, promote);
+    if (!mv) {
+      fail(u8"指し手を特定できませんでした");
+      return;
+    }
+    push(*mv);
+  }
+}
+
+optional<Move> Parser::resolve(Square to, PieceUnderlyingType type, Suffix suffix, int promote) const {
+  Move mv;
+  mv.color = next;
+  mv.piece = type | static_cast<PieceUnderlyingType>(next);
+  mv.to = to;
+  mv.promote = promote;
+  if (Piece target = position.pieces[to.file][to.rank]; target != 0 && ColorFromPiece(target) == next) {
+    return nullopt;
+  }
+  // to に利いている同じ種類の駒. 同じ種類の駒は歩の 18 枚が最大.
+  array<int, 18> candidates;
+  size_t size = 0;
+  if ((suffix & static_cast<SuffixUnderlyingType>(SuffixType::Drop)) == 0) {
+    Bitboard attackers = position.attackers(IndexFromSquare(to), next);
+    while (attackers && size < candidates.size()) {
+      if (int index = attackers.pop(); position.at(index) == mv.piece) {
+        candidates[size++] = index;
+      }
+    }
+  }
+  if (size == 0) {
+    if (promote != 0 || IsPromotedPiece(mv.piece)) {
+      return nullopt;
+    }
+    Hand const &hand = next == Color::Black ? handBlack : handWhite;
+    if (!hand.contains(PieceTypeFromPiece(mv.piece))) {
+      return nullopt;
+    }
+    mv.decideSuffix(position);
+    return mv;
+  }
+  auto complete = [&](int index) {
+    Move ret = mv;
+    ret.from = SquareFromIndex(index);
+    if (ret.promote == 0 && CanPromote(ret.piece) && IsPromotableMove(*ret.from, to, next)) {
+      ret.promote = -1;
+    }
+    ret.decideSuffix(position);
+    return ret;
+  };
+  if (size == 1 && (suffix & ~static_cast<SuffixUnderlyingType>(SuffixType::Drop)) == 0) {
+    return complete(candidates[0]);
+  }
+  // 候補ごとに decideSuffix で決まる表記と照合する. 一致するものが無ければ, 表記の一部が一致するものが 1 つだけの時にそれを選ぶ.
+  optional<Move> partial;
+  size_t partials = 0;
+  for (size_t i = 0; i < size; i++) {
+    Move c = complete(candidates[i]);
+    if (c.suffix == suffix) {
+      return c;
+    }
+    if (suffix != 0 && (c.suffix & suffix) == suffix) {
+      partial = c;
+      partials++;
+    }
+  }
+  if (partials == 1) {
+    return partial;
+  }
+  return nullopt;
+}
+
+void Parser::push(Move const &m) {
+  Move mv = m;
+  if (mv.from) {
+    // 成る手の駒は成る前の駒にそろえる (Game::Generate と同じ)
+    if (mv.promote == 1) {
+      mv.piece = Unpromote(mv.piece);
+    }
+    // Position::apply は移動元を調べないので, ここで確かめる
+    if (position.pieces[mv.from->file][mv.from->rank] != mv.piece || !Move::CanMove(position, *mv.from, mv.to) || (mv.promote == 1 && !CanPromote(mv.piece))) {
+      fail(u8"不正な指し手です");
+      return;
+    }
+  }
+  if (Piece captured = position.pieces[mv.to.file][mv.to.rank]; captured != 0) {
+    mv.captured = RemoveColorFromPiece(captured);
+  }
+  if (!position.apply(mv, handBlack, handWhite)) {
+    fail(u8"不正な指し手です");
+    return;
+  }
+  record.game.moves.push_back(PackedMoveFromMove(mv));
+  last = mv.to;
+  next = OpponentColor(next);
+}
+
+} // namespace
+
+size_t ParseKifu(u8string_view text, function<void(KifuRecord &&)> const &callback) {
+  Parser parser(callback);
+  Consume(text, u8"\xEF\xBB\xBF");
+  while (!text.empty()) {
+    auto end = text.find(u8'\n');
+    parser.line(text.substr(0, end));
+    text = end == u8string_view::npos ? u8string_view() : text.substr(end + 1);
+  }
+  parser.flush();
+  return parser.count;
+}
+
+bool ParseKifuFile(string const &path, function<void(KifuRecord &&)> const &callback) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size == 0) {
+    ::close(fd);
+    return true;
+  }
+  // 読み込み用のバッファを確保せず, ページキャッシュを直接読む
+  void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+  ParseKifu(u8string_view((char8_t const *)p, size), callback);
+  munmap(p, size);
+  return true;
+}
+
+vector<vector<KifuRecord>> ParseKifuFiles(span<string const> paths, unsigned threads) {
+  vector<vector<KifuRecord>> results(paths.size());
+  if (threads == 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  threads = (unsigned)min<size_t>(threads, paths.size());
+  atomic<size_t> next(0);
+  auto worker = [&]() {
+    while (true) {
+      size_t i = next.fetch_add(1, memory_order_relaxed);
+      if (i >= paths.size()) {
+        break;
+      }
+      bool ok = ParseKifuFile(paths[i], [&results, i](KifuRecord &&record) {
+        results[i].push_back(std::move(record));
+      });
+      if (!ok) {
+        KifuRecord record;
+        record.error = u8"ファイルを開けませんでした";
+        results[i].push_back(std::move(record));
+      }
+    }
+  };
+  if (threads <= 1) {
+    worker();
+    return results;
+  }
+  vector<thread> pool;
+  pool.reserve(threads - 1);
+  for (unsigned i = 1; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &th : pool) {
+    th.join();
+  }
+  return results;
+}
+
+} // namespace sci
@@ -0,0 +1,240 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+using namespace std;
+
+namespace sci {
+
+namespace {
+
+uint32_t const kInfinity = uint32_t(1) << 30;
+
+// 後手が攻め方の時に置換表のキーに xor する値. 同じ局面でも攻め方が違えば証明の意味が逆になるので, 別のエントリにする.
+uint64_t const kWhiteAttackerKey = 0x6a09e667f3bcc909ULL;
+
+uint32_t Add(uint32_t a, uint32_t b) {
+  return (uint32_t)min<uint64_t>(uint64_t(a) + b, kInfinity);
+}
+
+} // namespace
+
+MateSolver::MateSolver(size_t tableSize) {
+  table.resize(bit_ceil(max<size_t>(tableSize, kBucketSize)));
+}
+
+void MateSolver::clear() {
+  fill(table.begin(), table.end(), Entry());
+}
+
+MateSolver::Entry MateSolver::lookup(uint64_t key) const {
+  size_t index = key & (table.size() - kBucketSize);
+  for (size_t i = index; i < index + kBucketSize; i++) {
+    Entry const &e = table[i];
+    if (e.key == key && (e.pn == 0 || e.generation == generation)) {
+      return e;
+    }
+  }
+  Entry ret;
+  ret.key = key;
+  ret.pn = 1;
+  ret.dn = 1;
+  return ret;
+}
+
+int MateSolver::priority(Entry const &e) const {
+  if ((e.pn == 0 && e.dn == 0) || (e.pn != 0 && e.generation != generation)) {
+    // 空き, あるいは手数の上限が違う探索で書き込んだもの
+    return 0;
+  }
+  if (e.pn == 0) {
+    // 証明済みの局面は手順の復元に使うので, 今回の探索で証明したものはなるべく残す.
+    return e.generation > rootGeneration ? 3 : 1;
+  }
+  return 2;
+}
+
+void MateSolver::store(uint64_t key, uint32_t pn, uint32_t dn, uint32_t length) {
+  // kBucketSize 個のエントリを 1 組として使う. 同じ局面のエントリが無ければ, 最も優先度の低いものを上書きする.
+  size_t index = key & (table.size() - kBucketSize);
+  Entry *e = nullptr;
+  for (size_t i = index; i < index + kBucketSize; i++) {
+    if (table[i].key == key) {
+      e = &table[i];
+      break;
+    }
+    if (!e || priority(table[i]) < priority(*e)) {
+      e = &table[i];
+    }
+  }
+  e->key = key;
+  e->pn = pn;
+  e->dn = dn;
+  e->length = length;
+  e->generation = generation;
+}
+
+void MateSolver::generate(Color side, MoveList &moves) const {
+  if (side == attacker) {
+    Game::GenerateChecks(position, side, handBlack, handWhite, moves, true);
+  } else {
+    // 玉方には常に王手が掛かっている
+    Game::GenerateEvasions(position, side, handBlack, handWhite, moves, true);
+  }
+}
+
+bool MateSolver::interrupted() {
+  if (aborted) {
+    return true;
+  }
+  if (nodes >= maxNodes || stopSignal.load(memory_order_relaxed)) {
+    aborted = true;
+  } else if ((nodes & 0x3ff) == 0 && chrono::steady_clock::now() >= deadline) {
+    aborted = true;
+  }
+  return aborted;
+}
+
+// phi, delta は手番側から見た値. 攻め方の手番なら phi = 証明数, delta = 反証数. 玉方の手番なら逆になる.
+void MateSolver::search(Color side, uint32_t thPhi, uint32_t thDelta, int ply) {
+  nodes++;
+  bool const isOr = side == attacker;
+  uint64_t const key = position.hash ^ attackerKey;
+  if (frames.size() <= (size_t)ply) {
+    frames.emplace_back();
+  }
+  Frame &frame = frames[ply];
+  MoveList &moves = frame.moves;
+  generate(side, moves);
+  if (moves.empty()) {
+    // 手番側の負け. 攻め方なら不詰, 玉方なら詰み.
+    store(key, isOr ? kInfinity : 0, isOr ? 0 : kInfinity, 0);
+    return;
+  }
+  for (size_t i = 0; i < moves.size(); i++) {
+    auto undo = position.doMove(moves[i], handBlack, handWhite);
+    frame.hashes[i] = position.hash ^ attackerKey;
+    position.undoMove(moves[i], undo, handBlack, handWhite);
+  }
+
+  path.push_back(key);
+  while (true) {
+    uint32_t phi = kInfinity;
+    uint32_t delta = 0;
+    size_t best = 0;
+    uint32_t bestPhi = 0;
+    uint32_t bestDelta = kInfinity;
+    uint32_t secondDelta = kInfinity;
+    // 詰みまでの手数. 攻め方は最短の, 玉方は最長の手順を選ぶ.
+    uint32_t length = isOr ? kInfinity : 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+      uint32_t childPhi;
+      uint32_t childDelta;
+      uint64_t childKey = frame.hashes[i];
+      bool cut = ply + 1 > limit;
+      if (cut || find(path.begin(), path.end(), childKey) != path.end()) {
+        // 手数の上限か千日手 (連続王手). どちらも攻め方の失敗とする.
+        childPhi = isOr ? 0 : kInfinity;
+        childDelta = isOr ? kInfinity : 0;
+        limited |= cut;
+      } else {
+        Entry e = lookup(childKey);
+        childPhi = isOr ? e.dn : e.pn;
+        childDelta = isOr ? e.pn : e.dn;
+        if (e.pn == 0) {
+          length = isOr ? min<uint32_t>(length, e.length + 1) : max<uint32_t>(length, e.length + 1);
+        }
+      }
+      phi = min(phi, childDelta);
+      delta = Add(delta, childPhi);
+      if (childDelta < bestDelta) {
+        secondDelta = bestDelta;
+        bestDelta = childDelta;
+        bestPhi = childPhi;
+        best = i;
+      } else if (childDelta < secondDelta) {
+        secondDelta = childDelta;
+      }
+    }
+    uint32_t pn = isOr ? phi : delta;
+    uint32_t dn = isOr ? delta : phi;
+    store(key, pn, dn, pn == 0 ? length : 0);
+    if (phi >= thPhi || delta >= thDelta || interrupted()) {
+      break;
+    }
+    uint32_t childThPhi = Add(thDelta - delta, bestPhi);
+    uint32_t childThDelta = min(thPhi, Add(secondDelta, 1));
+    Move const &mv = moves[best];
+    auto undo = position.doMove(mv, handBlack, handWhite);
+    search(OpponentColor(side), childThPhi, childThDelta, ply + 1);
+    position.undoMove(mv, undo, handBlack, handWhite);
+  }
+  path.pop_back();
+}
+
+MateSolver::Answer MateSolver::solve(Position const &position, Color color, Hand const &handBlack, Hand const &handWhite, uint64_t maxNodes, chrono::milliseconds timeout) {
+  aborted = false;
+  nodes = 0;
+  this->maxNodes = maxNodes;
+  deadline = chrono::steady_clock::now() + timeout;
+  path.clear();
+  this->position = position;
+  // 探索中は利きの表を使わないので, 差分更新の手間を省く.
+  this->position.disableAttackMap();
+  this->handBlack = handBlack;
+  this->handWhite = handWhite;
+  attacker = color;
+  attackerKey = color == Color::White ? kWhiteAttackerKey : 0;
+  rootGeneration = generation;
+
+  // 手数の上限を徐々に増やす. 上限が無いと, 詰まない長い王手の連続を延々と探索してしまうことがある.
+  Answer answer;
+  Entry root;
+  for (int l = 1;; l = min(kMaxPly, l + max(2, l / 4 * 2))) {
+    limit = l;
+    limited = false;
+    generation++;
+    search(color, kInfinity, kInfinity, 0);
+    root = lookup(position.hash ^ attackerKey);
+    if (root.pn == 0 || aborted || (root.dn == 0 && (!limited || l == kMaxPly))) {
+      break;
+    }
+  }
+  answer.nodes = nodes;
+  if (root.pn != 0) {
+    if (root.dn == 0) {
+      answer.result = Result::NoMate;
+    }
+    return answer;
+  }
+  answer.result = Result::Mate;
+
+  // 置換表をたどって手順を得る. 攻め方は最短の, 玉方は最長の手順を選ぶ.
+  Color side = color;
+  MoveList moves;
+  for (uint32_t i = 0; i < root.length; i++) {
+    generate(side, moves);
+    optional<Move> next;
+    uint32_t nextLength = 0;
+    for (Move const &mv : moves) {
+      auto undo = this->position.doMove(mv, this->handBlack, this->handWhite);
+      Entry e = lookup(this->position.hash ^ attackerKey);
+      this->position.undoMove(mv, undo, this->handBlack, this->handWhite);
+      if (e.pn != 0) {
+        continue;
+      }
+      if (!next || (side == color ? e.length < nextLength : e.length > nextLength)) {
+        next = mv;
+        nextLength = e.length;
+      }
+    }
+    if (!next) {
+      break;
+    }
+    next->decideSuffix(this->position);
+    this->position.doMove(*next, this->handBlack, this->handWhite);
+    answer.moves.push_back(*next);
+    side = OpponentColor(side);
+  }
+  return answer;
+}
+
+} // namespace sci
@@ -1032,7 +1032,7 @@ struct sci::Micro686AI::Impl {
     return pt;
   }
 
-  optional<Move> next(Position const &p, Color next, deque<Move> const &moves, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+  optional<Move> next(Position const &p, Color next, deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) {
     if (vpos.empty()) {
       vpos.resize(32);
       index = 16;
@@ -1092,53 +1092,55 @@ struct sci::Micro686AI::Impl {
 
       pos.turn = next == Color::Black ? ::Black : ::White;
 
-      for (auto const &h : hand) {
+      for (PieceType h : Hand::kTypes) {
+        uint32_t n = hand.count(h);
         switch (h) {
         case PieceType::Pawn:
-          pos.hand[color][::Piece::Pawn]++;
+          pos.hand[color][::Piece::Pawn] += n;
           break;
         case PieceType::Lance:
-          pos.hand[color][::Piece::Lance]++;
+          pos.hand[color][::Piece::Lance] += n;
           break;
         case PieceType::Knight:
-          pos.hand[color][::Piece::Knight]++;
+          pos.hand[color][::Piece::Knight] += n;
           break;
         case PieceType::Silver:
-          pos.hand[color][::Piece::Silver]++;
+          pos.hand[color][::Piece::Silver] += n;
           break;
         case PieceType::Gold:
-          pos.hand[color][::Piece::Gold]++;
+          pos.hand[color][::Piece::Gold] += n;
           break;
         case PieceType::Bishop:
-          pos.hand[color][::Piece::Bishop]++;
+          pos.hand[color][::Piece::Bishop] += n;
           break;
         case PieceType::Rook:
-          pos.hand[color][::Piece::Rook]++;
+          pos.hand[color][::Piece::Rook] += n;
           break;
         }
       }
-      for (auto const &h : handEnemy) {
+      for (PieceType h : Hand::kTypes) {
+        uint32_t n = handEnemy.count(h);
         switch (h) {
         case PieceType::Pawn:
-          pos.hand[opponent][::Piece::Pawn]++;
+          pos.hand[opponent][::Piece::Pawn] += n;
           break;
         case PieceType::Lance:
-          pos.hand[opponent][::Piece::Lance]++;
+          pos.hand[opponent][::Piece::Lance] += n;
           break;
         case PieceType::Knight:
-          pos.hand[opponent][::Piece::Knight]++;
+          pos.hand[opponent][::Piece::Knight] += n;
           break;
         case PieceType::Silver:
-          pos.hand[opponent][::Piece::Silver]++;
+          pos.hand[opponent][::Piece::Silver] += n;
           break;
         case PieceType::Gold:
-          pos.hand[opponent][::Piece::Gold]++;
+          pos.hand[opponent][::Piece::Gold] += n;
           break;
         case PieceType::Bishop:
-          pos.hand[opponent][::Piece::Bishop]++;
+          pos.hand[opponent][::Piece::Bishop] += n;
           break;
         case PieceType::Rook:
-          pos.hand[opponent][::Piece::Rook]++;
+          pos.hand[opponent][::Piece::Rook] += n;
           break;
         }
       }
@@ -1150,7 +1152,7 @@ struct sci::Micro686AI::Impl {
       }
     }
     for (size_t i = doneMove; i < moves.size(); i++) {
-      Move m = moves[i];
+      Move m = MoveFromPackedMove(moves[i]);
       int from = 0;
       if (m.from) {
         from = Micro686SquareFromSquare(*m.from);
@@ -1226,7 +1228,7 @@ Micro686AI::Micro686AI() : impl(make_unique<Impl>()) {
 
 Micro686AI::~Micro686AI() {}
 
-optional<Move> Micro686AI::next(Position const &p, Color next, deque<Move> const &moves, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+optional<Move> Micro686AI::next(Position const &p, Color next, deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) {
 #if SHOGI_CAMERA_ENABLE_MICRO686
   return impl->next(p, next, moves, hand, handEnemy);
 #else
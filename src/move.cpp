@@ -6,148 +6,156 @@ using namespace std;
 
 namespace sci {
 
+namespace {
+
+// 1 つのマスに利く同じ駒の数の最大値. 玉, 竜, 馬の 8 方向.
+constexpr size_t kMaxCandidates = 8;
+
+// 手番別に, to に対する駒の位置 (段の差の符号 + 1) から, その駒が to に動く時の動作を引く表. [ColorIndex][段の差の符号 + 1]
+constexpr SuffixType kActions[2][3] = {
+    {SuffixType::Down, SuffixType::Sideway, SuffixType::Up},
+    {SuffixType::Up, SuffixType::Sideway, SuffixType::Down},
+};
+
+// pieces だけを見て, to に利いている search の駒のマスを集める. Move::CanMove で 1 マスずつ調べるのと同じ結果になる.
+// 駒の動きは左右対称なので, to に置いた相手の色の search の利きが, to に 1 マスだけ動いて来られるマスになる.
+size_t ReverseAttackers(Position const &p, Piece search, Square to, std::array<Square, kMaxCandidates> &candidates) {
+  Color color = ColorFromPiece(search);
+  Piece target = p.pieces[to.file][to.rank];
+  if (target != 0 && ColorFromPiece(target) == color) {
+    return 0;
+  }
+  size_t size = 0;
+  Bitboard steps = kAttackTable.step[1 - ColorIndex(color)][RemoveColorFromPiece(search)][IndexFromSquare(to)];
+  while (steps) {
+    Square sq = SquareFromIndex(steps.pop());
+    if (p.pieces[sq.file][sq.rank] == search) {
+      candidates[size++] = sq;
+    }
+  }
+  // 走る利きは to から逆向きにたどり, 最初にぶつかった駒が search なら候補にする.
+  uint8_t directions = SlidingDirections(search);
+  for (int d = 0; directions != 0 && d < 8; d++) {
+    if (((directions >> d) & 1) == 0) {
+      continue;
+    }
+    int dx = kDirectionDx[(d + 4) % 8];
+    int dy = kDirectionDy[(d + 4) % 8];
+    for (int x = to.file + dx, y = to.rank + dy; 0 <= x && x < 9 && 0 <= y && y < 9; x += dx, y += dy) {
+      if (Piece piece = p.pieces[x][y]; piece != 0) {
+        if (piece == search) {
+          candidates[size++] = MakeSquare(x, y);
+        }
+        break;
+      }
+    }
+  }
+  return size;
+}
+
+} // namespace
+
 void Move::decideSuffix(Position const &p) {
   // this->to に効いている自軍の this->piece の一覧.
-  vector<Square> candidates;
+  std::array<Square, kMaxCandidates> candidates;
+  size_t size = 0;
   Piece search = promote == 1 ? RemoveStatusFromPiece(piece) : piece;
-  for (int y = 0; y < 9; y++) {
-    for (int x = 0; x < 9; x++) {
-      if (p.pieces[x][y] != search) {
-        continue;
-      }
-      Square sq = MakeSquare(x, y);
-      if (CanMove(p, sq, to)) {
-        candidates.push_back(sq);
+  if (p.attackMap.enabled()) {
+    // 利きの表があれば, to に利いている駒だけを調べればよい.
+    Piece target = p.pieces[to.file][to.rank];
+    if (target == 0 || ColorFromPiece(target) != color) {
+      Bitboard attackers = p.attackers(IndexFromSquare(to), color);
+      while (attackers && size < kMaxCandidates) {
+        int index = attackers.pop();
+        if (p.at(index) == search) {
+          candidates[size++] = SquareFromIndex(index);
+        }
       }
     }
+  } else {
+    size = ReverseAttackers(p, search, to, candidates);
   }
-  if (candidates.size() < 2) {
-    if (!from && candidates.size() == 1) {
+  if (size < 2) {
+    if (!from && size == 1) {
       suffix = static_cast<SuffixUnderlyingType>(SuffixType::Drop);
     } else {
       suffix = static_cast<SuffixUnderlyingType>(SuffixType::None);
     }
+    return;
   } else if (!from) {
     // candidates.size によらず, drop を指定するだけで手を特定できる
     suffix = static_cast<SuffixUnderlyingType>(SuffixType::Drop);
-  } else {
-    SquareSet up;
-    SquareSet down;
-    SquareSet sideway;
-    // piece 以外の candidate が piece に対して左右どちらに居るか.
-    SquareSet left;
-    SquareSet right;
-    for (auto const &candidate : candidates) {
-      if (candidate.rank > to.rank) {
-        if (color == Color::Black) {
-          up.insert(candidate);
-        } else {
-          down.insert(candidate);
-        }
-      } else if (candidate.rank < to.rank) {
-        if (color == Color::Black) {
-          down.insert(candidate);
-        } else {
-          up.insert(candidate);
-        }
-      }
-      if (candidate.file != to.file && candidate.rank == to.rank) {
-        sideway.insert(candidate);
+    return;
+  }
+  // candidates の添字を bit 位置とした集合
+  uint32_t up = 0;
+  uint32_t down = 0;
+  uint32_t sideway = 0;
+  // from 以外の candidate が from に対して左右どちらに居るか.
+  uint32_t left = 0;
+  uint32_t right = 0;
+  uint32_t self = 0;
+  for (size_t i = 0; i < size; i++) {
+    Square const &candidate = candidates[i];
+    uint32_t bit = uint32_t(1) << i;
+    int dy = candidate.rank - to.rank;
+    switch (kActions[ColorIndex(color)][(dy > 0) - (dy < 0) + 1]) {
+    case SuffixType::Up:
+      up |= bit;
+      break;
+    case SuffixType::Down:
+      down |= bit;
+      break;
+    default:
+      sideway |= bit;
+      break;
+    }
+    if (candidate == *from) {
+      self = bit;
+    } else {
+      int dx = candidate.file - from->file;
+      if (color == Color::White) {
+        dx = -dx;
       }
-      if (candidate.file != from->file || candidate.rank != from->rank) {
-        int dx = candidate.file - from->file;
-        if (color == Color::White) {
-          dx = -dx;
-        }
-        if (dx > 0) {
-          right.insert(candidate);
-        } else {
-          left.insert(candidate);
-        }
+      if (dx > 0) {
+        right |= bit;
+      } else {
+        left |= bit;
       }
     }
-    // "直" 判定の時の dy
-    int nearestDy = color == Color::Black ? -1 : 1;
+  }
+  // "直" 判定の時の dy
+  int nearestDy = color == Color::Black ? -1 : 1;
 
-    size_t const numUp = up.count(*from);
-    size_t const numDown = down.count(*from);
-    size_t const numSideway = sideway.count(*from);
-    if (numUp == 1 && up.size() == 1) {
-      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Up);
-      return;
-    } else if (numDown == 1 && down.size() == 1) {
-      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Down);
-      return;
-    } else if (numSideway == 1 && sideway.size() == 1) {
-      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Sideway);
-      return;
-    } else if (from->file == to.file && from->rank + nearestDy == to.rank && search != MakePiece(color, PieceType::Rook, PieceStatus::Promoted) && search != MakePiece(color, PieceType::Bishop, PieceStatus::Promoted)) {
-      // "直ぐ", と表現できるならそのようにする. ただし竜と馬には "直ぐ" は使わない.
-      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Nearest);
-      return;
-    } else if (numUp == 1) {
-      if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right);
-        return;
-      } else if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left);
-        return;
-      }
-      for (auto const &candidate : candidates) {
-        if (up.count(candidate) == 0) {
-          right.erase(candidate);
-          left.erase(candidate);
-        }
-      }
-      if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right) | static_cast<SuffixUnderlyingType>(SuffixType::Up);
-        return;
-      } else if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(SuffixType::Up);
-        return;
-      }
-    } else if (numDown == 1) {
-      if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left);
-        return;
-      } else if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right);
-        return;
-      }
-      for (auto const &candidate : candidates) {
-        if (down.count(candidate) == 0) {
-          right.erase(candidate);
-          left.erase(candidate);
-        }
-      }
-      if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right) | static_cast<SuffixUnderlyingType>(SuffixType::Down);
-        return;
-      } else if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(SuffixType::Down);
-        return;
-      }
-    } else if (numSideway == 1) {
-      if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left);
-        return;
-      } else if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right);
-        return;
-      }
-      for (auto const &candidate : candidates) {
-        if (sideway.count(candidate) == 0) {
-          right.erase(candidate);
-          left.erase(candidate);
-        }
-      }
-      if (right.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right) | static_cast<SuffixUnderlyingType>(SuffixType::Sideway);
-        return;
-      } else if (left.size() == 0) {
-        suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(SuffixType::Sideway);
-        return;
-      }
+  bool const isUp = (up & self) != 0;
+  bool const isDown = (down & self) != 0;
+  bool const isSideway = (sideway & self) != 0;
+  if (isUp && std::popcount(up) == 1) {
+    suffix = static_cast<SuffixUnderlyingType>(SuffixType::Up);
+  } else if (isDown && std::popcount(down) == 1) {
+    suffix = static_cast<SuffixUnderlyingType>(SuffixType::Down);
+  } else if (isSideway && std::popcount(sideway) == 1) {
+    suffix = static_cast<SuffixUnderlyingType>(SuffixType::Sideway);
+  } else if (from->file == to.file && from->rank + nearestDy == to.rank && search != MakePiece(color, PieceType::Rook, PieceStatus::Promoted) && search != MakePiece(color, PieceType::Bishop, PieceStatus::Promoted)) {
+    // "直ぐ", と表現できるならそのようにする. ただし竜と馬には "直ぐ" は使わない.
+    suffix = static_cast<SuffixUnderlyingType>(SuffixType::Nearest);
+  } else if (isUp || isDown || isSideway) {
+    SuffixType action = isUp ? SuffixType::Up : (isDown ? SuffixType::Down : SuffixType::Sideway);
+    uint32_t same = isUp ? up : (isDown ? down : sideway);
+    // 上る時は右端・左端の順, 引く時と寄る時は左端・右端の順に調べる.
+    SuffixType first = isUp ? SuffixType::Right : SuffixType::Left;
+    SuffixType second = isUp ? SuffixType::Left : SuffixType::Right;
+    auto others = [&](SuffixType side) {
+      return side == SuffixType::Right ? right : left;
+    };
+    if (others(first) == 0) {
+      suffix = static_cast<SuffixUnderlyingType>(first);
+    } else if (others(second) == 0) {
+      suffix = static_cast<SuffixUnderlyingType>(second);
+    } else if ((right & same) == 0) {
+      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Right) | static_cast<SuffixUnderlyingType>(action);
+    } else if ((left & same) == 0) {
+      suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(action);
     }
   }
 }
@@ -162,72 +170,20 @@ bool Move::CanMove(Position const &position, Square from, Square to) {
   if (pieceTo != 0 && ColorFromPiece(pieceTo) == color) {
     return false;
   }
-
-  struct Step {
-    Step(int x, int y, int count = 1) : x(x), y(y), count(count) {}
-    int x;
-    int y;
-    int count;
-  };
-  static map<Piece, vector<Step>> const sSteps = {
-      {MakePiece(Color::Black, PieceType::King), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{-1, 1}, Step{0, 1}, Step{1, 1}}},
-      {MakePiece(Color::Black, PieceType::Rook), {Step{0, -1, 8}, Step{1, 0, 8}, Step{0, 1, 8}, Step{-1, 0, 8}}},
-      {MakePiece(Color::Black, PieceType::Bishop), {Step{-1, -1, 8}, Step{1, -1, 8}, Step{1, 1, 8}, Step{-1, 1, 8}}},
-      {MakePiece(Color::Black, PieceType::Gold), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-      {MakePiece(Color::Black, PieceType::Silver), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 1}, Step{1, 1}}},
-      {MakePiece(Color::Black, PieceType::Knight), {Step{-1, -2}, Step{1, -2}}},
-      {MakePiece(Color::Black, PieceType::Lance), {Step{0, -1, 8}}},
-      {MakePiece(Color::Black, PieceType::Pawn), {Step{0, -1}}},
-      {MakePiece(Color::Black, PieceType::Rook, PieceStatus::Promoted), {Step{0, -1, 8}, Step{1, 0, 8}, Step{0, 1, 8}, Step{-1, 0, 8}, Step{-1, -1}, Step{1, -1}, Step{-1, 1}, Step{1, 1}}},
-      {MakePiece(Color::Black, PieceType::Bishop, PieceStatus::Promoted), {Step{-1, -1, 8}, Step{1, -1, 8}, Step{1, 1, 8}, Step{-1, 1, 8}, Step{0, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-      {MakePiece(Color::Black, PieceType::Silver, PieceStatus::Promoted), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-      {MakePiece(Color::Black, PieceType::Knight, PieceStatus::Promoted), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-      {MakePiece(Color::Black, PieceType::Lance, PieceStatus::Promoted), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-      {MakePiece(Color::Black, PieceType::Pawn, PieceStatus::Promoted), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{0, 1}}},
-
-      {MakePiece(Color::White, PieceType::King), {Step{-1, -1}, Step{0, -1}, Step{1, -1}, Step{-1, 0}, Step{1, 0}, Step{-1, 1}, Step{0, 1}, Step{1, 1}}},
-      {MakePiece(Color::White, PieceType::Rook), {Step{0, -1, 8}, Step{1, 0, 8}, Step{0, 1, 8}, Step{-1, 0, 8}}},
-      {MakePiece(Color::White, PieceType::Bishop), {Step{-1, -1, 8}, Step{1, -1, 8}, Step{1, 1, 8}, Step{-1, 1, 8}}},
-      {MakePiece(Color::White, PieceType::Gold), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-      {MakePiece(Color::White, PieceType::Silver), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, -1}, Step{-1, -1}}},
-      {MakePiece(Color::White, PieceType::Knight), {Step{1, 2}, Step{-1, 2}}},
-      {MakePiece(Color::White, PieceType::Lance), {Step{0, 1, 8}}},
-      {MakePiece(Color::White, PieceType::Pawn), {Step{0, 1}}},
-      {MakePiece(Color::White, PieceType::Rook, PieceStatus::Promoted), {Step{0, 1, 8}, Step{-1, 0, 8}, Step{0, -1, 8}, Step{1, 0, 8}, Step{1, 1}, Step{-1, 1}, Step{1, -1}, Step{-1, -1}}},
-      {MakePiece(Color::White, PieceType::Bishop, PieceStatus::Promoted), {Step{1, 1, 8}, Step{-1, 1, 8}, Step{-1, -1, 8}, Step{1, -1, 8}, Step{0, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-      {MakePiece(Color::White, PieceType::Silver, PieceStatus::Promoted), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-      {MakePiece(Color::White, PieceType::Knight, PieceStatus::Promoted), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-      {MakePiece(Color::White, PieceType::Lance, PieceStatus::Promoted), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-      {MakePiece(Color::White, PieceType::Pawn, PieceStatus::Promoted), {Step{1, 1}, Step{0, 1}, Step{-1, 1}, Step{1, 0}, Step{-1, 0}, Step{0, -1}}},
-  };
-  auto found = sSteps.find(pieceFrom);
-  if (found == sSteps.end()) {
+  int f = IndexFromSquare(from);
+  int t = IndexFromSquare(to);
+  // 間に駒が無いと仮定した時に利いているかどうかを調べてから, 間のマスが空いているか調べる.
+  // position のビットボードが pieces と同期していなくても判定できるよう, 間のマスは pieces を見る.
+  if (!AttacksSquare(pieceFrom, f, t, Bitboard())) {
     return false;
   }
-  vector<Step> const &steps = found->second;
-  for (Step const &step : steps) {
-    for (int i = 1; i <= step.count; i++) {
-      int x = from.file + step.x * i;
-      int y = from.rank + step.y * i;
-      if (x < 0 || 9 <= x || y < 0 || 9 <= y) {
-        break;
-      }
-      Piece t = position.pieces[x][y];
-      if (t == 0) {
-        if (x == to.file && y == to.rank) {
-          return true;
-        }
-        continue;
-      } else if (ColorFromPiece(t) == color) {
-        break;
-      } else if (x == to.file && y == to.rank) {
-        return true;
-      } else {
-        break;
-      }
+  Bitboard between = BetweenBitboard(f, t);
+  while (between) {
+    if (position.at(between.pop()) != 0) {
+      return false;
     }
   }
-  return false;
+  return true;
 }
 
 } // namespace sci
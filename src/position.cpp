@@ -7,35 +7,101 @@ using namespace std;
 namespace sci {
 
 bool Position::isInCheck(Color color) const {
-  Piece search = MakePiece(color, PieceType::King);
-  optional<Square> king;
-  for (int y = 0; y < 9; y++) {
-    for (int x = 0; x < 9; x++) {
-      if (search == pieces[x][y]) {
-        king = MakeSquare(x, y);
-        break;
-      }
-    }
-  }
-  if (!king) {
+  int king = kingSquare[ColorIndex(color)];
+  if (king < 0) {
     // 玉が居なければ王手は掛からない(?).
     return false;
   }
-  for (int y = 0; y < 9; y++) {
-    for (int x = 0; x < 9; x++) {
-      Piece p = pieces[x][y];
-      if (p == 0 || ColorFromPiece(p) == color) {
-        continue;
-      }
-      if (Move::CanMove(*this, MakeSquare(x, y), *king)) {
-        return true;
-      }
+  return !attackers(king, OpponentColor(color)).empty();
+}
+
+Bitboard Position::attackers(int index, Color color) const {
+  if (attackMap.enabled()) {
+    return attackMap.attackers(index, color);
+  }
+  return attackers(index, color, all());
+}
+
+Bitboard Position::attackers(int index, Color color, Bitboard const &occ) const {
+  if (color == Color::Black) {
+    return attackers<Color::Black>(index, occ);
+  } else {
+    return attackers<Color::White>(index, occ);
+  }
+}
+
+template <Color C>
+Bitboard Position::attackers(int index, Bitboard const &occ) const {
+  // C 側の駒が index に利いているかどうかは, 相手側の同じ駒を index に置いた時の利きの先に, その駒が居るかどうかで判定できる.
+  constexpr Color opponent = OpponentColor(C);
+  Bitboard unpromoted = ~promoted;
+  auto type = [this](PieceType t) {
+    return types[static_cast<PieceUnderlyingType>(t)];
+  };
+  Bitboard golds = type(PieceType::Gold) | (promoted & (type(PieceType::Silver) | type(PieceType::Knight) | type(PieceType::Lance) | type(PieceType::Pawn)));
+  Bitboard kings = type(PieceType::King) | (promoted & (type(PieceType::Rook) | type(PieceType::Bishop)));
+  Bitboard ret;
+  ret |= StepAttacks(MakePiece(opponent, PieceType::Pawn), index) & type(PieceType::Pawn) & unpromoted;
+  ret |= StepAttacks(MakePiece(opponent, PieceType::Knight), index) & type(PieceType::Knight) & unpromoted;
+  ret |= StepAttacks(MakePiece(opponent, PieceType::Silver), index) & type(PieceType::Silver) & unpromoted;
+  ret |= StepAttacks(MakePiece(opponent, PieceType::Gold), index) & golds;
+  ret |= StepAttacks(MakePiece(opponent, PieceType::King), index) & kings;
+  ret |= Attacks(MakePiece(opponent, PieceType::Rook), index, occ) & type(PieceType::Rook);
+  ret |= Attacks(MakePiece(opponent, PieceType::Bishop), index, occ) & type(PieceType::Bishop);
+  ret |= Attacks(MakePiece(opponent, PieceType::Lance), index, occ) & type(PieceType::Lance) & unpromoted;
+  return ret & occupied[ColorIndex(C)];
+}
+
+template Bitboard Position::attackers<Color::Black>(int, Bitboard const &) const;
+template Bitboard Position::attackers<Color::White>(int, Bitboard const &) const;
+
+Bitboard Position::pinned(Color color) const {
+  if (color == Color::Black) {
+    return pinned<Color::Black>();
+  } else {
+    return pinned<Color::White>();
+  }
+}
+
+template <Color C>
+Bitboard Position::pinned() const {
+  return blockers<C>() & occupied[ColorIndex(C)];
+}
+
+template Bitboard Position::pinned<Color::Black>() const;
+template Bitboard Position::pinned<Color::White>() const;
+
+template <Color C>
+Bitboard Position::blockers() const {
+  int k = kingSquare[ColorIndex(C)];
+  if (k < 0) {
+    return Bitboard();
+  }
+  constexpr Color opponent = OpponentColor(C);
+  auto type = [this](PieceType t) {
+    return types[static_cast<PieceUnderlyingType>(t)];
+  };
+  // 間の駒が無ければ玉に利く, 相手の走り駒
+  Bitboard snipers;
+  snipers |= Attacks(MakePiece(C, PieceType::Rook), k, Bitboard()) & type(PieceType::Rook);
+  snipers |= Attacks(MakePiece(C, PieceType::Bishop), k, Bitboard()) & type(PieceType::Bishop);
+  snipers |= Attacks(MakePiece(C, PieceType::Lance), k, Bitboard()) & type(PieceType::Lance).andNot(promoted);
+  snipers &= occupied[ColorIndex(opponent)];
+  Bitboard occ = all();
+  Bitboard ret;
+  while (snipers) {
+    Bitboard between = BetweenBitboard(k, snipers.pop()) & occ;
+    if (between.count() == 1) {
+      ret |= between;
     }
   }
-  return false;
+  return ret;
 }
 
-bool Position::apply(Move const &mv, deque<PieceType> &handBlack, deque<PieceType> &handWhite) {
+template Bitboard Position::blockers<Color::Black>() const;
+template Bitboard Position::blockers<Color::White>() const;
+
+bool Position::isApplicable(Move const &mv, Hand const &hand) const {
   auto to = pieces[mv.to.file][mv.to.rank];
   if (mv.captured) {
     if (to == 0) {
@@ -56,82 +122,288 @@ bool Position::apply(Move const &mv, deque<PieceType> &handBlack, deque<PieceTyp
       return false;
     }
   }
-  auto &hand = mv.color == Color::Black ? handBlack : handWhite;
   if (mv.from) {
-    pieces[mv.from->file][mv.from->rank] = 0;
-  } else {
-    if (pieces[mv.to.file][mv.to.rank] != 0) {
-      // 既に駒の居るマスに打った
-      return false;
-    }
-    if (IsPromotedPiece(mv.piece)) {
-      // 成駒を打った
-      return false;
+    return true;
+  }
+  if (to != 0) {
+    // 既に駒の居るマスに打った
+    return false;
+  }
+  if (IsPromotedPiece(mv.piece)) {
+    // 成駒を打った
+    return false;
+  }
+  PieceType type = PieceTypeFromPiece(mv.piece);
+  if (type == PieceType::King) {
+    // 玉は持ち駒にできない
+    return false;
+  }
+  if (!hand.contains(type)) {
+    // 持ち駒に無い駒を打った
+    return false;
+  }
+  Rank minRank = Rank::Rank1;
+  Rank maxRank = Rank::Rank9;
+  switch (type) {
+  case PieceType::Pawn:
+  case PieceType::Lance:
+    if (mv.color == Color::Black) {
+      minRank = Rank::Rank2;
+    } else {
+      maxRank = Rank::Rank8;
     }
-    PieceType type = PieceTypeFromPiece(mv.piece);
-    if (type == PieceType::King) {
-      // 玉は持ち駒にできない
-      return false;
+    break;
+  case PieceType::Knight:
+    if (mv.color == Color::Black) {
+      minRank = Rank::Rank3;
+    } else {
+      maxRank = Rank::Rank7;
     }
-    bool ok = false;
-    for (auto it = hand.begin(); it != hand.end(); it++) {
-      if (*it == type) {
-        hand.erase(it);
-        ok = true;
-        break;
+    break;
+  default:
+    break;
+  }
+  if (mv.to.rank < minRank || maxRank < mv.to.rank) {
+    // 反則となる駒打ち
+    return false;
+  }
+  if (type == PieceType::Pawn) {
+    for (int y = 0; y < 9; y++) {
+      if (pieces[mv.to.file][y] == MakePiece(mv.color, PieceType::Pawn)) {
+        // 二歩
+        return false;
       }
     }
-    if (!ok) {
-      // 持ち駒に無い駒を打った
+  }
+  return true;
+}
+
+bool Position::apply(Move const &mv, Hand &handBlack, Hand &handWhite) {
+  if (!isApplicable(mv, mv.color == Color::Black ? handBlack : handWhite)) {
+    return false;
+  }
+  doMove(mv, handBlack, handWhite);
+  if (isInCheck(mv.color)) {
+    // 王手放置. 反則の判定に使うので, 指した後の局面のままにする.
+    return false;
+  }
+  return true;
+}
+
+Position::Undo Position::doMove(Move const &mv, Hand &handBlack, Hand &handWhite) {
+  Undo undo;
+  undo.hash = hash;
+  auto &hand = mv.color == Color::Black ? handBlack : handWhite;
+  int to = IndexFromSquare(mv.to);
+  int from = mv.from ? IndexFromSquare(*mv.from) : -1;
+  Bitboard affected;
+  if (attackMap.enabled()) {
+    affected = beginAttackMapUpdate(from, to);
+  }
+  if (mv.from) {
+    undo.moved = remove(from);
+  } else {
+    PieceType type = PieceTypeFromPiece(mv.piece);
+    hash ^= ZobristHand(mv.color, type, hand.count(type));
+    hand.remove(type);
+    undo.moved = mv.piece;
+  }
+  undo.captured = at(to);
+  if (undo.captured != 0) {
+    remove(to);
+    PieceType type = PieceTypeFromPiece(undo.captured);
+    hand.add(type);
+    hash ^= ZobristHand(mv.color, type, hand.count(type));
+  }
+  if (mv.promote == 1 && !IsPromotedPiece(mv.piece)) {
+    put(to, Promote(mv.piece));
+  } else {
+    put(to, mv.piece);
+  }
+  hash ^= kZobrist.white;
+  if (attackMap.enabled()) {
+    endAttackMapUpdate(affected, from, to);
+  }
+  return undo;
+}
+
+void Position::undoMove(Move const &mv, Undo const &undo, Hand &handBlack, Hand &handWhite) {
+  auto &hand = mv.color == Color::Black ? handBlack : handWhite;
+  int to = IndexFromSquare(mv.to);
+  int from = mv.from ? IndexFromSquare(*mv.from) : -1;
+  Bitboard affected;
+  if (attackMap.enabled()) {
+    affected = beginAttackMapUpdate(from, to);
+  }
+  remove(to);
+  if (undo.captured != 0) {
+    put(to, undo.captured);
+    hand.remove(PieceTypeFromPiece(undo.captured));
+  }
+  if (mv.from) {
+    put(from, undo.moved);
+  } else {
+    hand.add(PieceTypeFromPiece(undo.moved));
+  }
+  hash = undo.hash;
+  if (attackMap.enabled()) {
+    endAttackMapUpdate(affected, from, to);
+  }
+}
+
+bool Position::isPawnDropMate(int index, Color color) const {
+  Color opponent = OpponentColor(color);
+  Bitboard const enemy = occupied[ColorIndex(opponent)];
+  int k = kingSquare[ColorIndex(opponent)];
+  if (k < 0) {
+    return false;
+  }
+  // 歩を打った後の盤面の駒の有無. 打った歩は types に含まれないので, 歩自身の利きは attackers に現れない.
+  Bitboard occ = all();
+  occ.set(index);
+
+  // 玉が逃げる, あるいは玉で歩を取る
+  Bitboard escapes = StepAttacks(MakePiece(opponent, PieceType::King), k).andNot(enemy);
+  Bitboard withoutKing = occ;
+  withoutKing.reset(k);
+  while (escapes) {
+    if (!attackers(escapes.pop(), color, withoutKing)) {
       return false;
     }
-    Rank minRank = Rank::Rank1;
-    Rank maxRank = Rank::Rank9;
-    switch (type) {
-    case PieceType::Pawn:
-    case PieceType::Lance:
-      if (mv.color == Color::Black) {
-        minRank = Rank::Rank2;
-      } else {
-        maxRank = Rank::Rank8;
-      }
-      break;
-    case PieceType::Knight:
-      if (mv.color == Color::Black) {
-        minRank = Rank::Rank3;
-      } else {
-        maxRank = Rank::Rank7;
-      }
-      break;
-    default:
-      break;
-    }
-    if (mv.to.rank < minRank || maxRank < mv.to.rank) {
-      // 反則となる駒打ち
+  }
+
+  // 玉以外の駒で歩を取る. 取った結果自玉に王手が掛かる (ピンされている) 駒では取れない.
+  Bitboard defenders = attackers(index, opponent, occ);
+  defenders.reset(k);
+  while (defenders) {
+    Bitboard after = occ;
+    after.reset(defenders.pop());
+    if (!attackers(k, color, after)) {
       return false;
     }
-    if (type == PieceType::Pawn) {
-      for (int y = 0; y < 9; y++) {
-        if (pieces[mv.to.file][y] == MakePiece(mv.color, PieceType::Pawn)) {
-          // 二歩
-          return false;
-        }
+  }
+  return true;
+}
+
+void Position::sync() {
+  occupied[0] = occupied[1] = promoted = Bitboard();
+  for (auto &bb : types) {
+    bb = Bitboard();
+  }
+  kingSquare[0] = kingSquare[1] = -1;
+  hash = 0;
+  for (int index = 0; index < 81; index++) {
+    Piece p = at(index);
+    if (p != 0) {
+      put(index, p);
+    }
+  }
+  if (attackMap.enabled()) {
+    attackMap.table = make_shared<AttackMap::Table>();
+    updateAttackMap(all(), true);
+  }
+}
+
+void Position::sync(Hand const &handBlack, Hand const &handWhite, Color next) {
+  sync();
+  syncHand(handBlack, handWhite, next);
+}
+
+void Position::syncHand(Hand const &handBlack, Hand const &handWhite, Color next) {
+  for (Color color : {Color::Black, Color::White}) {
+    Hand const &hand = color == Color::Black ? handBlack : handWhite;
+    for (PieceType type : Hand::kTypes) {
+      for (uint32_t n = 1; n <= hand.count(type); n++) {
+        hash ^= ZobristHand(color, type, n);
       }
     }
   }
-  if (mv.promote == 1 && !IsPromotedPiece(mv.piece)) {
-    pieces[mv.to.file][mv.to.rank] = Promote(mv.piece);
-  } else {
-    pieces[mv.to.file][mv.to.rank] = mv.piece;
+  if (next == Color::White) {
+    hash ^= kZobrist.white;
   }
-  if (mv.captured) {
-    hand.push_back(PieceTypeFromPiece(Unpromote(*mv.captured)));
+}
+
+void Position::put(int index, Piece p) {
+  pieces[index / 9][index % 9] = p;
+  occupied[ColorIndex(ColorFromPiece(p))].set(index);
+  types[static_cast<PieceUnderlyingType>(PieceTypeFromPiece(p))].set(index);
+  if (IsPromotedPiece(p)) {
+    promoted.set(index);
   }
-  if (isInCheck(mv.color)) {
-    // 王手放置
-    return false;
+  if (PieceTypeFromPiece(p) == PieceType::King) {
+    kingSquare[ColorIndex(ColorFromPiece(p))] = index;
+  }
+  hash ^= ZobristPiece(p, index);
+}
+
+Piece Position::remove(int index) {
+  Piece p = at(index);
+  pieces[index / 9][index % 9] = 0;
+  occupied[ColorIndex(ColorFromPiece(p))].reset(index);
+  types[static_cast<PieceUnderlyingType>(PieceTypeFromPiece(p))].reset(index);
+  promoted.reset(index);
+  if (PieceTypeFromPiece(p) == PieceType::King) {
+    kingSquare[ColorIndex(ColorFromPiece(p))] = -1;
+  }
+  hash ^= ZobristPiece(p, index);
+  return p;
+}
+
+void Position::enableAttackMap() {
+  if (attackMap.enabled()) {
+    return;
+  }
+  attackMap.table = make_shared<AttackMap::Table>();
+  updateAttackMap(all(), true);
+}
+
+void Position::disableAttackMap() {
+  attackMap = AttackMap();
+}
+
+Bitboard Position::beginAttackMapUpdate(int from, int to) {
+  // 駒の有無が変わるマスの駒と, そのマスに走る利きが届いている飛・角・香の利きが変わる. それ以外の駒の利きは変わらない.
+  Bitboard squares = Bitboard::FromIndex(to);
+  if (from >= 0) {
+    squares.set(from);
+  }
+  Bitboard sliders = types[static_cast<PieceUnderlyingType>(PieceType::Rook)] | types[static_cast<PieceUnderlyingType>(PieceType::Bishop)] | types[static_cast<PieceUnderlyingType>(PieceType::Lance)].andNot(promoted);
+  Bitboard affected;
+  Bitboard it = squares;
+  while (it) {
+    int index = it.pop();
+    affected |= attackMap.attackers(index, Color::Black) | attackMap.attackers(index, Color::White);
+  }
+  affected = (affected & sliders) | (squares & all());
+  updateAttackMap(affected, false);
+  return affected;
+}
+
+void Position::endAttackMapUpdate(Bitboard affected, int from, int to) {
+  affected.set(to);
+  if (from >= 0) {
+    affected.set(from);
+  }
+  updateAttackMap(affected & all(), true);
+}
+
+void Position::updateAttackMap(Bitboard squares, bool add) {
+  auto &table = Unshare(attackMap.table);
+  Bitboard const occ = all();
+  while (squares) {
+    int index = squares.pop();
+    Piece p = at(index);
+    auto &attackers = table[ColorIndex(ColorFromPiece(p))];
+    Bitboard targets = Attacks(p, index, occ);
+    while (targets) {
+      int target = targets.pop();
+      if (add) {
+        attackers[target].set(index);
+      } else {
+        attackers[target].reset(index);
+      }
+    }
   }
-  return true;
 }
 
 u8string Position::debugString() const {
@@ -144,7 +416,7 @@ u8string Position::debugString() const {
       } else {
         ret += u8" ";
       }
-      ret += ShortStringFromPieceTypeAndStatus(RemoveColorFromPiece(piece));
+      ret += ShortStringViewFromPieceTypeAndStatus(RemoveColorFromPiece(piece));
     }
     ret += u8"\n";
   }
@@ -0,0 +1,68 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <atomic>
+
+using namespace std;
+
+namespace sci {
+
+namespace {
+
+// 1 度に取り出す棋譜の数. 1 局ずつ取り出すと, 短い棋譜が続いた時にカウンタの奪い合いが増える.
+size_t const kChunkSize = 16;
+
+ReplayResult Replay(Game &game, ReplayGame const &input) {
+  game.reset(input.handicap, input.handicapHand);
+  ReplayResult ret;
+  for (PackedMove const &packed : input.moves) {
+    Move mv = MoveFromPackedMove(packed);
+    ret.ply++;
+    ret.result = game.apply(mv);
+    if (ret.result != Game::ApplyResult::Ok) {
+      break;
+    }
+    game.moves.push_back(packed);
+  }
+  return ret;
+}
+
+} // namespace
+
+vector<ReplayResult> ReplayGames(span<ReplayGame const> games, unsigned threads) {
+  vector<ReplayResult> results(games.size());
+  if (threads == 0) {
+    threads = max(1u, thread::hardware_concurrency());
+  }
+  threads = (unsigned)min<size_t>(threads, (games.size() + kChunkSize - 1) / kChunkSize);
+  atomic<size_t> next(0);
+  // スレッドごとに Game を 1 つ使い回す. 棋譜と千日手の表の領域は reset で再利用されるので, 確保は最初の数局でほぼ済む.
+  auto worker = [&]() {
+    Game game(Handicap::平手, false);
+    while (true) {
+      size_t begin = next.fetch_add(kChunkSize, memory_order_relaxed);
+      if (begin >= games.size()) {
+        break;
+      }
+      size_t end = min(begin + kChunkSize, games.size());
+      for (size_t i = begin; i < end; i++) {
+        results[i] = Replay(game, games[i]);
+      }
+    }
+  };
+  if (threads <= 1) {
+    worker();
+    return results;
+  }
+  vector<thread> pool;
+  pool.reserve(threads - 1);
+  for (unsigned i = 1; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &th : pool) {
+    th.join();
+  }
+  return results;
+}
+
+} // namespace sci
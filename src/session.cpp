@@ -1251,15 +1251,24 @@ void CreateWarpedBoard(cv::Mat const &frameGray, cv::Mat const &frameColor, Stat
   }
 }
 
+// 対局中の詰み探索の置換表のエントリ数と, 1 局面あたりの探索の上限.
+size_t const kMateTableSize = size_t(1) << 18;
+uint64_t const kMateMaxNodes = 2000000;
+chrono::milliseconds const kMateTimeout(3000);
+
 } // namespace
 
-Session::Session() : game(Handicap::平手, false) {
+Session::Session() : game(Handicap::平手, false), mateSolver(kMateTableSize) {
+  // 指し手の検出と符号の決定で利きを何度も調べるので, 利きの表を持たせる.
+  game.position.enableAttackMap();
   s = make_shared<Status>();
   stop = false;
   thread runThread(std::bind(&Session::run, this));
   this->runThread.swap(runThread);
   thread playerThread(std::bind(&Session::runPlayer, this));
   this->playerThread.swap(playerThread);
+  thread mateThread(std::bind(&Session::runMate, this));
+  this->mateThread.swap(mateThread);
 }
 
 Session::~Session() {
@@ -1276,6 +1285,12 @@ Session::~Session() {
   runThread.join();
   playerThreadCv.notify_all();
   playerThread.join();
+  {
+    lock_guard<mutex> lk(mut);
+    mateSolver.stop();
+  }
+  mateThreadCv.notify_all();
+  mateThread.join();
 }
 
 void Session::run() {
@@ -1299,10 +1314,20 @@ void Session::run() {
     s->game = this->game;
     s->started = this->started;
     s->handicapReady = this->s->handicapReady;
+    s->mate = this->mate;
     memcpy(s->similarityAgainstStableBoard, this->s->similarityAgainstStableBoard, sizeof(s->similarityAgainstStableBoard));
+    shared_ptr<KifuWriter> kifu = std::move(nextKifu);
 
     lock.unlock();
 
+    if (kifu) {
+      // 記録を始める前に指した手もまとめて書く. game.moves の末尾には, まだ盤上で指されていない AI の手があることがある.
+      for (size_t i = 0; i < min(detected.size(), game.moves.size()); i++) {
+        kifu->append(MoveFromPackedMove(game.moves[i]));
+      }
+      stat.kifu = kifu;
+    }
+
     cv::Mat frameGray;
     cv::cvtColor(frameColor, frameGray, cv::COLOR_RGB2GRAY);
 
@@ -1326,11 +1351,11 @@ void Session::run() {
                 unsafeResign(output.color, *s);
               }
             } else {
-              if (game.moves.back().color == output.move->color) {
+              if (MoveFromPackedMove(game.moves.back()).color == output.move->color) {
                 unsafeResign(output.color, *s);
               }
             }
-            game.moves.push_back(*output.move);
+            game.moves.push_back(PackedMoveFromMove(*output.move));
           } else {
             unsafeResign(output.color, *s);
           }
@@ -1427,6 +1452,26 @@ void Session::run() {
         }
       }
     }
+    if (!s->result && detected.size() == game.moves.size()) {
+      // 局面が進んだので詰み探索をやり直す. 探索中のものは結果が要らなくなるので中断する.
+      // game.moves の末尾にまだ盤上で指されていない AI の手がある間は, game.position と手番が食い違うので依頼しない.
+      // runMate が入力を受け取る時に中断を解除するので, stop() も入力と同じ排他の中で呼ぶ.
+      bool notify = false;
+      {
+        lock_guard<mutex> lk(mut);
+        pair<uint64_t, Color> key(game.position.hash, game.next());
+        if (mateRequested != key) {
+          nextMateInput = make_unique<MateInput>(game.moves.size(), game.position, game.next(), game.handBlack, game.handWhite);
+          mate = nullopt;
+          mateSolver.stop();
+          mateRequested = key;
+          notify = true;
+        }
+      }
+      if (notify) {
+        mateThreadCv.notify_all();
+      }
+    }
     s->waitingMove = detected.size() != game.moves.size();
     s->game = game;
     if (!stat.stableBoardHistory.empty()) {
@@ -1436,6 +1481,10 @@ void Session::run() {
     if (!s->result && ret) {
       s->result = ret;
     }
+    if (s->result && stat.kifu) {
+      stat.kifu->finish(*s->result);
+      stat.kifu = nullptr;
+    }
     this->s = s;
   }
 }
@@ -1456,11 +1505,40 @@ void Session::runPlayer() {
 
     Output output;
     output.color = input->color;
-    output.move = input->player->next(input->position, input->color, input->moves, input->hand, input->handEnemy);
+    output.move = input->player->next(input->position, input->color, input->moves.deque(), input->hand, input->handEnemy);
     promise->set_value(output);
   }
 }
 
+void Session::runMate() {
+  while (!stop) {
+    unique_lock<mutex> lock(mut);
+    mateThreadCv.wait(lock, [this]() { return nextMateInput || stop; });
+    if (stop) {
+      lock.unlock();
+      break;
+    }
+    unique_ptr<MateInput> input;
+    input.swap(nextMateInput);
+    mateSolver.resetStop();
+    lock.unlock();
+
+    auto answer = mateSolver.solve(input->position, input->color, input->handBlack, input->handWhite, kMateMaxNodes, kMateTimeout);
+    if (answer.result != MateSolver::Result::Mate) {
+      continue;
+    }
+    lock_guard<mutex> lk(mut);
+    if (nextMateInput) {
+      // 探索中に局面が進んでいる
+      continue;
+    }
+    Status::Mate m;
+    m.ply = input->ply;
+    m.moves = answer.moves;
+    mate = m;
+  }
+}
+
 void Session::push(cv::Mat const &frame) {
   {
     lock_guard<mutex> lock(mut);
@@ -1504,6 +1582,18 @@ void Session::unsafeResign(Color color, Status &s) {
 void Session::setHandicap(Handicap h, bool handicapHand) {
   lock_guard<mutex> lk(mut);
   game = Game(h, handicapHand);
+  game.position.enableAttackMap();
+  // 同じ局面から始めても, 新しい対局として詰み探索をやり直す
+  mateRequested = nullopt;
+}
+
+void Session::recordKifu(string const &path, KifuHeader const &header, KifuFormat format) {
+  auto kifu = make_shared<KifuWriter>(format);
+  if (!kifu->open(path, header)) {
+    return;
+  }
+  lock_guard<mutex> lk(mut);
+  nextKifu = kifu;
 }
 
 void Session::startGame(GameStartParameter p) {
@@ -1591,6 +1681,11 @@ void Session::csaAdapterDidFinishGame(GameResult result, GameResultReason reason
   stop = true;
   runThreadCv.notify_all();
   playerThreadCv.notify_all();
+  {
+    lock_guard<mutex> lk(mut);
+    mateSolver.stop();
+  }
+  mateThreadCv.notify_all();
 }
 
 } // namespace sci
@@ -0,0 +1,408 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+using namespace std;
+
+namespace sci {
+
+namespace {
+
+// [PieceType]
+char const kSfenPieces[] = " KRBGSNLP";
+
+// [PieceType]. 1 組の駒の枚数で, 持ち駒として持てる最大の枚数でもある. 玉は別に数える.
+uint32_t const kMaxHand[9] = {0, 0, 2, 2, 4, 4, 4, 4, 18};
+
+// 盤上と持ち駒を合わせて 1 組の駒の枚数を超えず, 玉が各側 1 枚までかどうか.
+// 詰将棋のように手番側の玉が無い局面は読めるようにするが, 手番でない側の玉は必ず 1 枚あること.
+bool HasValidPieceCounts(Position const &p, Hand const &handBlack, Hand const &handWhite, Color next) {
+  uint32_t counts[9] = {};
+  int kings[2] = {};
+  for (int x = 0; x < 9; x++) {
+    for (int y = 0; y < 9; y++) {
+      Piece piece = p.pieces[x][y];
+      if (piece == 0) {
+        continue;
+      }
+      PieceType type = PieceTypeFromPiece(piece);
+      if (type == PieceType::King) {
+        kings[ColorIndex(ColorFromPiece(piece))]++;
+      } else {
+        counts[static_cast<PieceUnderlyingType>(type)]++;
+      }
+    }
+  }
+  for (PieceType type : Hand::kTypes) {
+    auto t = static_cast<PieceUnderlyingType>(type);
+    if (counts[t] + handBlack.count(type) + handWhite.count(type) > kMaxHand[t]) {
+      return false;
+    }
+  }
+  return kings[ColorIndex(next)] <= 1 && kings[ColorIndex(OpponentColor(next))] == 1;
+}
+
+optional<PieceType> PieceTypeFromSfenChar(char c) {
+  switch (c) {
+  case 'K':
+  case 'k':
+    return PieceType::King;
+  case 'R':
+  case 'r':
+    return PieceType::Rook;
+  case 'B':
+  case 'b':
+    return PieceType::Bishop;
+  case 'G':
+  case 'g':
+    return PieceType::Gold;
+  case 'S':
+  case 's':
+    return PieceType::Silver;
+  case 'N':
+  case 'n':
+    return PieceType::Knight;
+  case 'L':
+  case 'l':
+    return PieceType::Lance;
+  case 'P':
+  case 'p':
+    return PieceType::Pawn;
+  default:
+    return nullopt;
+  }
+}
+
+char SfenCharFromPiece(Piece p) {
+  char c = kSfenPieces[static_cast<PieceUnderlyingType>(PieceTypeFromPiece(p))];
+  if (ColorFromPiece(p) == Color::White) {
+    c = c - 'A' + 'a';
+  }
+  return c;
+}
+
+optional<Square> SquareFromSfen(char file, char rank) {
+  if (file < '1' || '9' < file || rank < 'a' || 'i' < rank) {
+    return nullopt;
+  }
+  return MakeSquare(9 - (file - '0'), rank - 'a');
+}
+
+void AppendSquare(string &s, Square sq) {
+  s += char('0' + 9 - sq.file);
+  s += char('a' + sq.rank);
+}
+
+// 先頭の空白で区切られた 1 語を取り出し, sv をその後ろまで進める.
+string_view NextToken(string_view &sv) {
+  size_t begin = sv.find_first_not_of(' ');
+  if (begin == string_view::npos) {
+    sv = string_view();
+    return sv;
+  }
+  size_t end = sv.find(' ', begin);
+  if (end == string_view::npos) {
+    end = sv.size();
+  }
+  string_view token = sv.substr(begin, end - begin);
+  sv.remove_prefix(end);
+  return token;
+}
+
+} // namespace
+
+optional<SfenPosition> SfenPositionFromString(string_view sfen) {
+  SfenPosition ret;
+  Position &p = ret.position;
+  for (int x = 0; x < 9; x++) {
+    for (int y = 0; y < 9; y++) {
+      p.pieces[x][y] = 0;
+    }
+  }
+
+  // 盤面
+  string_view board = NextToken(sfen);
+  int x = 0;
+  int y = 0;
+  bool promoted = false;
+  for (char c : board) {
+    if (c == '/') {
+      if (x != 9 || y >= 8 || promoted) {
+        return nullopt;
+      }
+      x = 0;
+      y++;
+    } else if ('1' <= c && c <= '9') {
+      x += c - '0';
+      if (x > 9 || promoted) {
+        return nullopt;
+      }
+    } else if (c == '+') {
+      if (promoted) {
+        return nullopt;
+      }
+      promoted = true;
+    } else {
+      auto type = PieceTypeFromSfenChar(c);
+      if (!type || x >= 9) {
+        return nullopt;
+      }
+      Piece piece = MakePiece('a' <= c && c <= 'z' ? Color::White : Color::Black, *type);
+      if (promoted) {
+        if (!CanPromote(piece)) {
+          return nullopt;
+        }
+        piece = Promote(piece);
+      }
+      p.pieces[x][y] = piece;
+      x++;
+      promoted = false;
+    }
+  }
+  if (x != 9 || y != 8 || promoted) {
+    return nullopt;
+  }
+
+  // 手番
+  string_view next = NextToken(sfen);
+  if (next == "b") {
+    ret.next = Color::Black;
+  } else if (next == "w") {
+    ret.next = Color::White;
+  } else {
+    return nullopt;
+  }
+
+  // 持ち駒
+  string_view hand = NextToken(sfen);
+  if (hand.empty()) {
+    return nullopt;
+  }
+  if (hand != "-") {
+    uint32_t count = 0;
+    for (char c : hand) {
+      if ('0' <= c && c <= '9') {
+        count = count * 10 + (c - '0');
+        if (count > 18) {
+          return nullopt;
+        }
+        continue;
+      }
+      auto type = PieceTypeFromSfenChar(c);
+      if (!type || *type == PieceType::King) {
+        return nullopt;
+      }
+      Hand &h = 'a' <= c && c <= 'z' ? ret.handWhite : ret.handBlack;
+      uint32_t n = count == 0 ? 1 : count;
+      if (h.count(*type) + n > kMaxHand[static_cast<PieceUnderlyingType>(*type)]) {
+        return nullopt;
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        h.add(*type);
+      }
+      count = 0;
+    }
+    if (count != 0) {
+      return nullopt;
+    }
+  }
+
+  // 手数. 省略可
+  string_view ply = NextToken(sfen);
+  if (!ply.empty()) {
+    int v = 0;
+    for (char c : ply) {
+      if (c < '0' || '9' < c || v > 100000) {
+        return nullopt;
+      }
+      v = v * 10 + (c - '0');
+    }
+    ret.ply = v;
+  }
+  if (!NextToken(sfen).empty()) {
+    return nullopt;
+  }
+  if (!HasValidPieceCounts(p, ret.handBlack, ret.handWhite, ret.next)) {
+    return nullopt;
+  }
+
+  p.sync(ret.handBlack, ret.handWhite, ret.next);
+  return ret;
+}
+
+string SfenStringFromPosition(Position const &position, Hand const &handBlack, Hand const &handWhite, Color next, int ply) {
+  string s;
+  s.reserve(96);
+  for (int y = 0; y < 9; y++) {
+    if (y > 0) {
+      s += '/';
+    }
+    int empty = 0;
+    for (int x = 0; x < 9; x++) {
+      Piece p = position.pieces[x][y];
+      if (p == 0) {
+        empty++;
+        continue;
+      }
+      if (empty > 0) {
+        s += char('0' + empty);
+        empty = 0;
+      }
+      if (IsPromotedPiece(p)) {
+        s += '+';
+      }
+      s += SfenCharFromPiece(p);
+    }
+    if (empty > 0) {
+      s += char('0' + empty);
+    }
+  }
+  s += next == Color::Black ? " b " : " w ";
+  if (handBlack.empty() && handWhite.empty()) {
+    s += '-';
+  } else {
+    for (Color color : {Color::Black, Color::White}) {
+      Hand const &hand = color == Color::Black ? handBlack : handWhite;
+      for (PieceType type : Hand::kTypes) {
+        uint32_t count = hand.count(type);
+        if (count == 0) {
+          continue;
+        }
+        if (count > 1) {
+          s += to_string(count);
+        }
+        s += SfenCharFromPiece(MakePiece(color, type));
+      }
+    }
+  }
+  s += ' ';
+  s += to_string(ply);
+  return s;
+}
+
+optional<Move> MoveFromSfenMove(string_view sfen, Position const &position, Color color) {
+  if (sfen.size() != 4 && sfen.size() != 5) {
+    return nullopt;
+  }
+  auto to = SquareFromSfen(sfen[2], sfen[3]);
+  if (!to) {
+    return nullopt;
+  }
+  Move mv;
+  mv.color = color;
+  mv.to = *to;
+  if (sfen[1] == '*') {
+    // 駒打ち
+    auto type = PieceTypeFromSfenChar(sfen[0]);
+    if (sfen.size() != 4 || !type || *type == PieceType::King || sfen[0] < 'A' || 'Z' < sfen[0]) {
+      return nullopt;
+    }
+    mv.piece = MakePiece(color, *type);
+  } else {
+    auto from = SquareFromSfen(sfen[0], sfen[1]);
+    if (!from) {
+      return nullopt;
+    }
+    Piece existing = position.pieces[from->file][from->rank];
+    if (existing == 0 || ColorFromPiece(existing) != color) {
+      return nullopt;
+    }
+    mv.piece = existing;
+    mv.from = *from;
+    bool promotable = CanPromote(existing) && IsPromotableMove(*from, *to, color);
+    if (sfen.size() == 5) {
+      if (sfen[4] != '+' || !promotable) {
+        return nullopt;
+      }
+      mv.promote = 1;
+    } else if (promotable) {
+      mv.promote = -1;
+    }
+    Piece captured = position.pieces[to->file][to->rank];
+    if (captured != 0) {
+      mv.captured = RemoveColorFromPiece(captured);
+    }
+  }
+  mv.decideSuffix(position);
+  return mv;
+}
+
+string SfenStringFromMove(Move const &mv) {
+  string s;
+  s.reserve(5);
+  if (mv.from) {
+    AppendSquare(s, *mv.from);
+  } else {
+    s += kSfenPieces[static_cast<PieceUnderlyingType>(PieceTypeFromPiece(mv.piece))];
+    s += '*';
+  }
+  AppendSquare(s, mv.to);
+  if (mv.promote == 1) {
+    s += '+';
+  }
+  return s;
+}
+
+string SfenStringFromGame(Game const &game) {
+  // 現在の局面から棋譜を逆にたどって開始局面に戻す.
+  Position position = game.position;
+  Hand handBlack = game.handBlack;
+  Hand handWhite = game.handWhite;
+  for (auto it = game.moves.rbegin(); it != game.moves.rend(); it++) {
+    Move mv = MoveFromPackedMove(*it);
+    Position::Undo undo;
+    // 成る手の piece は成る前の駒の場合と, 成った後の駒の場合がある.
+    undo.moved = mv.promote == 1 ? Unpromote(mv.piece) : mv.piece;
+    undo.captured = mv.captured ? (*mv.captured | static_cast<PieceUnderlyingType>(OpponentColor(mv.color))) : 0;
+    undo.hash = position.hash;
+    position.undoMove(mv, undo, handBlack, handWhite);
+  }
+  string s = "sfen " + SfenStringFromPosition(position, handBlack, handWhite, game.first);
+  if (!game.moves.empty()) {
+    s.reserve(s.size() + 6 + game.moves.size() * 6);
+    s += " moves";
+    for (PackedMove const &packed : game.moves) {
+      s += ' ';
+      s += SfenStringFromMove(MoveFromPackedMove(packed));
+    }
+  }
+  return s;
+}
+
+optional<Game> GameFromSfenString(string_view sfen) {
+  string_view rest = sfen;
+  string_view token = NextToken(rest);
+  if (token == "position") {
+    token = NextToken(rest);
+  }
+  Game game(Handicap::平手, false);
+  if (token == "sfen") {
+    size_t moves = rest.find(" moves");
+    auto p = SfenPositionFromString(rest.substr(0, moves));
+    if (!p) {
+      return nullopt;
+    }
+    game.position = p->position;
+    game.handBlack = p->handBlack;
+    game.handWhite = p->handWhite;
+    game.first = p->next;
+    rest = moves == string_view::npos ? string_view() : rest.substr(moves);
+  } else if (token != "startpos") {
+    return nullopt;
+  }
+  token = NextToken(rest);
+  if (token.empty()) {
+    return game;
+  }
+  if (token != "moves") {
+    return nullopt;
+  }
+  while (!(token = NextToken(rest)).empty()) {
+    auto mv = MoveFromSfenMove(token, game.position, game.next());
+    if (!mv || game.apply(*mv) == Game::ApplyResult::Illegal) {
+      return nullopt;
+    }
+    game.moves.push_back(PackedMoveFromMove(*mv));
+  }
+  return game;
+}
+
+} // namespace sci
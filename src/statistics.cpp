@@ -31,6 +31,7 @@ bool IsIdentical(set<T, L> const &a, set<T, L> const &b) {
 void AppendPromotion(Move &mv,
                      cv::Mat const &boardBefore, cv::Mat const &boardBeforeColor,
                      cv::Mat const &boardAfter, cv::Mat const &boardAfterColor,
+                     LegalMoveSet const &legalMoves,
                      PieceBook &book,
                      optional<Move> hint,
                      Status const &s,
@@ -41,15 +42,32 @@ void AppendPromotion(Move &mv,
   if (!CanPromote(mv.piece)) {
     return;
   }
+  bool const promoteLegal = legalMoves.contains(*mv.from, mv.to, true);
+  bool const unpromoteLegal = legalMoves.contains(*mv.from, mv.to, false);
+  if (promoteLegal || unpromoteLegal) {
+    // 合法手なら, 成・不成のどちらが合法手の集合にあるかで, 画像を比べるまでもなく決まる場合がある.
 #if !SHOGI_CAMERA_DEBUG
-  if (!IsPromotableMove(*mv.from, mv.to, mv.color)) {
-    return;
-  }
+    if (!promoteLegal) {
+      return;
+    }
 #endif
-  if (MustPromote(PieceTypeFromPiece(mv.piece), *mv.from, mv.to, mv.color)) {
-    mv.piece = Promote(mv.piece);
-    mv.promote = 1;
-    return;
+    if (!unpromoteLegal) {
+      mv.piece = Promote(mv.piece);
+      mv.promote = 1;
+      return;
+    }
+  } else {
+    // 反則手. 棋譜に残すために, 成ったかどうかを規則と画像から判定する.
+#if !SHOGI_CAMERA_DEBUG
+    if (!IsPromotableMove(*mv.from, mv.to, mv.color)) {
+      return;
+    }
+#endif
+    if (MustPromote(PieceTypeFromPiece(mv.piece), *mv.from, mv.to, mv.color)) {
+      mv.piece = Promote(mv.piece);
+      mv.promote = 1;
+      return;
+    }
   }
 
 #if SHOGI_CAMERA_DISABLE_HINT
@@ -323,7 +341,7 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
                                           cv::Mat const &fullcolor,
                                           Status &s,
                                           Game &g,
-                                          vector<Move> &detected,
+                                          vector<PackedMove> &detected,
                                           bool detectMove) {
   if (board.size().area() <= 0) {
     return nullopt;
@@ -429,7 +447,12 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
   CvPointSet const &ch = changeset.front();
   optional<Move> hint;
   if (detected.size() + 1 == g.moves.size()) {
-    hint = g.moves.back();
+    hint = MoveFromPackedMove(g.moves.back());
+  }
+  if (legalMovesHash != g.position.hash) {
+    // 局面が確定するたびに 1 度だけ作る
+    legalMoves.reset(g.position, color, g.handBlack, g.handWhite);
+    legalMovesHash = g.position.hash;
   }
   optional<Move> move = Detect(last.back().gray_, last.back().fullcolor,
                                board, fullcolor,
@@ -439,6 +462,7 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
                                detected,
                                color,
                                g.hand(color),
+                               legalMoves,
                                *book,
                                hint,
                                s,
@@ -486,13 +510,13 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
 
     book->update(g.position, board, s);
   } else {
-    lastMoveTo = detected.back().to;
+    lastMoveTo = MoveFromPackedMove(detected.back()).to;
   }
   move->decideSuffix(g.position);
   bool aiHand = detected.size() + 1 == g.moves.size();
   if (aiHand) {
     // g.moves.back() は AI が生成した手なので, それと合致しているか調べる.
-    if (*move != g.moves.back()) {
+    if (*move != MoveFromPackedMove(g.moves.back())) {
       s.wrongMove = true;
       cout << "AIの示した手と違う手が指されている" << endl;
       return nullopt;
@@ -500,11 +524,14 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
     g.moves.pop_back();
   }
   s.wrongMove = false;
-  detected.push_back(*move);
+  detected.push_back(PackedMoveFromMove(*move));
   optional<Status::Result> ret;
   switch (g.apply(*move)) {
   case Game::ApplyResult::Ok:
-    g.moves.push_back(*move);
+    g.moves.push_back(PackedMoveFromMove(*move));
+    if (kifu) {
+      kifu->append(*move);
+    }
     break;
   case Game::ApplyResult::Illegal:
     if (!s.result) {
@@ -549,7 +576,9 @@ optional<Status::Result> Statistics::push(cv::Mat const &board,
     stableBoardHistory.pop_front();
   }
   book->update(g.position, board, s);
-  cout << g.moves.size() << ":" << (char const *)StringFromMoveWithOptionalLast(*move, lastMoveTo).c_str() << endl;
+  MoveStringBuffer str;
+  FormatMoveTo(back_inserter(str), *move, lastMoveTo ? &*lastMoveTo : nullptr);
+  cout << g.moves.size() << ":" << str.c_str() << endl;
   return ret;
 }
 
@@ -558,9 +587,10 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
                                   vector<shared_ptr<PieceContour>> const &pieces,
                                   CvPointSet const &changes,
                                   Position const &position,
-                                  vector<Move> const &moves,
+                                  vector<PackedMove> const &moves,
                                   Color const &color,
-                                  deque<PieceType> const &hand,
+                                  Hand const &hand,
+                                  LegalMoveSet const &legalMoves,
                                   PieceBook &book,
                                   optional<Move> hint,
                                   Status const &s,
@@ -580,7 +610,7 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
         Move mv;
         mv.color = color;
         mv.to = MakeSquare(ch.x, ch.y);
-        mv.piece = MakePiece(color, *hand.begin());
+        mv.piece = MakePiece(color, hand.pieces().front());
         move = mv;
       } else {
         cv::Mat roi = Img::PieceROI(boardAfter, ch.x, ch.y);
@@ -594,7 +624,7 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
             return;
           }
           PieceType pt = PieceTypeFromPiece(piece);
-          if (find(hand.begin(), hand.end(), pt) == hand.end()) {
+          if (!hand.contains(pt)) {
             // 持ち駒に無い.
             return;
           }
@@ -639,15 +669,23 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
       // 相手の駒がいるマス全てについて, 直前のマス画像との類似度を調べる. 類似度が最も低かったマスを, 取られた駒の居たマスとする.
       double minSim = numeric_limits<double>::max();
       optional<Square> minSquare;
-      // まず駒の向きが自分と同じ向きになっているものだけを対象に調べる. 見つからなければ駒の向きは無視して調べる.
-      for (bool directionAware : {true, false}) {
+      int const from = IndexFromSquare(MakeSquare(ch.x, ch.y));
+      // まず合法手で取れる駒, かつ駒の向きが自分と同じ向きになっているものだけを対象に調べる. 見つからなければ順に条件を緩める.
+      // 初手は盤面の向きが決まっていないので, 合法手かどうかは問わない.
+      for (auto [legalOnly, directionAware] : {pair(true, true), pair(true, false), pair(false, true), pair(false, false)}) {
+        if (legalOnly && moves.empty()) {
+          continue;
+        }
         for (int y = 0; y < 9; y++) {
           for (int x = 0; x < 9; x++) {
             auto piece = position.pieces[x][y];
             if (piece == 0 || ColorFromPiece(piece) == color) {
               continue;
             }
-            if (!Move::CanMove(position, MakeSquare(ch.x, ch.y), MakeSquare(x, y))) {
+            if (!position.attackers(IndexFromSquare(MakeSquare(x, y)), color).test(from)) {
+              continue;
+            }
+            if (legalOnly && !legalMoves.contains(MakeSquare(ch.x, ch.y), MakeSquare(x, y), false) && !legalMoves.contains(MakeSquare(ch.x, ch.y), MakeSquare(x, y), true)) {
               continue;
             }
             if (directionAware) {
@@ -703,7 +741,7 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
         mv.captured = RemoveColorFromPiece(position.pieces[minSquare->file][minSquare->rank]);
         mv.piece = p;
         if (!moves.empty()) {
-          AppendPromotion(mv, before, beforeColor, after, afterColor, book, hint, s, pool);
+          AppendPromotion(mv, before, beforeColor, after, afterColor, legalMoves, book, hint, s, pool);
         }
         move = mv;
       } else {
@@ -730,13 +768,13 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
           // p0 の駒が p1 の駒を取った.
           Square from = MakeSquare(ch0.x, ch0.y);
           Square to = MakeSquare(ch1.x, ch1.y);
-          if (moves.empty() || Move::CanMove(position, from, to)) {
+          if (moves.empty() || position.attackers(IndexFromSquare(to), color).test(IndexFromSquare(from))) {
             mv.from = from;
             mv.to = to;
             mv.piece = p0;
             mv.captured = RemoveColorFromPiece(p1);
             if (!moves.empty()) {
-              AppendPromotion(mv, before, beforeColor, after, afterColor, book, hint, s, pool);
+              AppendPromotion(mv, before, beforeColor, after, afterColor, legalMoves, book, hint, s, pool);
             }
             move = mv;
           } else {
@@ -746,13 +784,13 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
           // p1 の駒が p0 の駒を取った.
           Square from = MakeSquare(ch1.x, ch1.y);
           Square to = MakeSquare(ch0.x, ch0.y);
-          if (moves.empty() || Move::CanMove(position, from, to)) {
+          if (moves.empty() || position.attackers(IndexFromSquare(to), color).test(IndexFromSquare(from))) {
             mv.from = from;
             mv.to = to;
             mv.piece = p1;
             mv.captured = RemoveColorFromPiece(p0);
             if (!moves.empty()) {
-              AppendPromotion(mv, before, beforeColor, after, afterColor, book, hint, s, pool);
+              AppendPromotion(mv, before, beforeColor, after, afterColor, legalMoves, book, hint, s, pool);
             }
             move = mv;
           } else {
@@ -765,14 +803,14 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
         // p0 の駒が p1 に移動
         Square from = MakeSquare(ch0.x, ch0.y);
         Square to = MakeSquare(ch1.x, ch1.y);
-        if (moves.empty() || Move::CanMove(position, from, to)) {
+        if (moves.empty() || position.attackers(IndexFromSquare(to), color).test(IndexFromSquare(from))) {
           Move mv;
           mv.color = color;
           mv.from = from;
           mv.to = to;
           mv.piece = p0;
           if (!moves.empty()) {
-            AppendPromotion(mv, before, beforeColor, after, afterColor, book, hint, s, pool);
+            AppendPromotion(mv, before, beforeColor, after, afterColor, legalMoves, book, hint, s, pool);
           }
           move = mv;
         } else {
@@ -786,14 +824,14 @@ optional<Move> Statistics::Detect(cv::Mat const &boardBefore, cv::Mat const &boa
         // p1 の駒が p0 に移動
         Square from = MakeSquare(ch1.x, ch1.y);
         Square to = MakeSquare(ch0.x, ch0.y);
-        if (moves.empty() || Move::CanMove(position, from, to)) {
+        if (moves.empty() || position.attackers(IndexFromSquare(to), color).test(IndexFromSquare(from))) {
           Move mv;
           mv.color = color;
           mv.from = from;
           mv.to = to;
           mv.piece = p1;
           if (!moves.empty()) {
-            AppendPromotion(mv, before, beforeColor, after, afterColor, book, hint, s, pool);
+            AppendPromotion(mv, before, beforeColor, after, afterColor, legalMoves, book, hint, s, pool);
           }
           move = mv;
         } else {
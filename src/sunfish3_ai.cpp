@@ -117,7 +117,7 @@ sunfish::Piece SunfishPieceFromPiece(Piece p) {
   return Piece(index);
 }
 
-static sunfish::Board SunfishBoardFromPositionAndHand(Position const &position, deque<PieceType> const &handBlack, deque<PieceType> const &handWhite, Color next) {
+static sunfish::Board SunfishBoardFromPositionAndHand(Position const &position, Hand const &handBlack, Hand const &handWhite, Color next) {
   sunfish::CompactBoard cb;
   int index = 0;
   for (int y = 0; y < 9; y++) {
@@ -133,12 +133,12 @@ static sunfish::Board SunfishBoardFromPositionAndHand(Position const &position,
       cb.buf[index++] = c | s;
     }
   }
-  for (auto const &p : handBlack) {
+  for (PieceType p : handBlack.pieces()) {
     sunfish::Piece sp = SunfishPieceFromPiece(MakePiece(Color::Black, p));
     uint16_t c = static_cast<uint16_t>(sp.black().index()) << sunfish::CompactBoard::PieceShift;
     cb.buf[index++] = c | sunfish::CompactBoard::Hand;
   }
-  for (auto const &p : handWhite) {
+  for (PieceType p : handWhite.pieces()) {
     sunfish::Piece sp = SunfishPieceFromPiece(MakePiece(Color::White, p));
     uint16_t c = static_cast<uint16_t>(sp.white().index()) << sunfish::CompactBoard::PieceShift;
     cb.buf[index++] = c | sunfish::CompactBoard::Hand;
@@ -170,7 +170,7 @@ struct Sunfish3AI::Impl {
     lock.unlock();
   }
 
-  optional<Move> next(Position const &p, Color color, deque<Move> const &, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+  optional<Move> next(Position const &p, Color color, deque<PackedMove> const &, Hand const &hand, Hand const &handEnemy) {
     sunfish::Record record;
     record.init(
         SunfishBoardFromPositionAndHand(
@@ -204,8 +204,8 @@ struct Sunfish3AI::Impl {
     }
   }
 
-  optional<Move> random(Position const &p, Color color, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
-    deque<Move> candidates;
+  optional<Move> random(Position const &p, Color color, Hand const &hand, Hand const &handEnemy) {
+    MoveList candidates;
     Game::Generate(p, color, color == Color::Black ? hand : handEnemy, color == Color::Black ? handEnemy : hand, candidates, true);
     if (candidates.empty()) {
       return nullopt;
@@ -233,7 +233,7 @@ struct Sunfish3AI::Impl {
 struct Sunfish3AI::Impl {
   Impl() {}
 
-  optional<Move> next(Position const &p, Color next, deque<Move> const &moves, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+  optional<Move> next(Position const &p, Color next, deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) {
     return nullopt;
   }
 
@@ -249,7 +249,7 @@ Sunfish3AI::Sunfish3AI() : impl(make_unique<Impl>()) {
 
 Sunfish3AI::~Sunfish3AI() {}
 
-optional<Move> Sunfish3AI::next(Position const &p, Color next, deque<Move> const &moves, deque<PieceType> const &hand, deque<PieceType> const &handEnemy) {
+optional<Move> Sunfish3AI::next(Position const &p, Color next, deque<PackedMove> const &moves, Hand const &hand, Hand const &handEnemy) {
   return impl->next(p, next, moves, hand, handEnemy);
 }
 
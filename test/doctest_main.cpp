@@ -12,6 +12,8 @@ using namespace sci;
 
 #include "game.test.hpp"
 #include "img.test.hpp"
+#include "kifu.test.hpp"
+#include "mate_solver.test.hpp"
 #include "move.test.hpp"
 
 namespace sci {
@@ -3,7 +3,7 @@ static Game::ApplyResult MustMove(std::string const &msg, Game &g) {
   REQUIRE(std::holds_alternative<Move>(mv));
   auto m = std::get<Move>(mv);
   auto ret = g.apply(m);
-  g.moves.push_back(m);
+  g.moves.push_back(PackedMoveFromMove(m));
   return ret;
 }
 
@@ -68,6 +68,43 @@ TEST_CASE("game") {
       CHECK(MustMove("-1314FU", g) == Game::ApplyResult::Ok);
       CHECK(MustMove("+5352UM", g) == Game::ApplyResult::Ok);
       CHECK(MustMove("-6172KI", g) == Game::ApplyResult::Illegal);
+      // 反則の判定に使うので, 指した後の局面のままになる
+      CHECK(g.position.pieces[File::File7][Rank::Rank2] == MakePiece(Color::White, PieceType::Gold));
+      CHECK(g.position.pieces[File::File6][Rank::Rank1] == 0);
+    }
+    SUBCASE("打ち歩詰め") {
+      Game g(Handicap::平手, false);
+      for (int x = 0; x < 9; x++) {
+        for (int y = 0; y < 9; y++) {
+          g.position.pieces[x][y] = 0;
+        }
+      }
+      g.position.pieces[File::File1][Rank::Rank1] = MakePiece(Color::White, PieceType::King);
+      g.position.pieces[File::File2][Rank::Rank1] = MakePiece(Color::White, PieceType::Knight);
+      g.position.pieces[File::File2][Rank::Rank3] = MakePiece(Color::Black, PieceType::Gold);
+      g.position.pieces[File::File5][Rank::Rank9] = MakePiece(Color::Black, PieceType::King);
+      g.handBlack.add(PieceType::Pawn);
+      g.position.sync(g.handBlack, g.handWhite, Color::Black);
+      Move mv;
+      mv.color = Color::Black;
+      mv.piece = MakePiece(Color::Black, PieceType::Pawn);
+      mv.to = MakeSquare(File::File1, Rank::Rank2);
+      std::deque<Move> moves;
+      g.generate(moves);
+      CHECK(std::find(moves.begin(), moves.end(), mv) == moves.end());
+      {
+        Game h = g;
+        CHECK(h.apply(mv) == Game::ApplyResult::Illegal);
+        // 指した後の局面のままになる
+        CHECK(h.position.pieces[File::File1][Rank::Rank2] == mv.piece);
+        CHECK(h.handBlack.count(PieceType::Pawn) == 0);
+      }
+      // 2三の金が無ければ玉で歩を取れる
+      g.position.pieces[File::File2][Rank::Rank3] = 0;
+      g.position.sync(g.handBlack, g.handWhite, Color::Black);
+      g.generate(moves);
+      CHECK(std::find(moves.begin(), moves.end(), mv) != moves.end());
+      CHECK(g.apply(mv) == Game::ApplyResult::Ok);
     }
     SUBCASE("二歩") {
       Game g(Handicap::平手, false);
@@ -80,4 +117,365 @@ TEST_CASE("game") {
       CHECK(MustMove("+0056FU", g) == Game::ApplyResult::Illegal);
     }
   }
+  SUBCASE("generate") {
+    SUBCASE("平手") {
+      Game g(Handicap::平手, false);
+      std::deque<Move> moves;
+      g.generate(moves);
+      CHECK(moves.size() == 30);
+      MoveList list;
+      g.generate(list);
+      REQUIRE(list.size() == 30);
+      CHECK(std::equal(list.begin(), list.end(), moves.begin()));
+      Move last = list[29];
+      list.remove(0);
+      CHECK(list.size() == 29);
+      CHECK(list[0] == last);
+    }
+    SUBCASE("角交換") {
+      Game g(Handicap::平手, false);
+      CHECK(MustMove("+7776FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+8822UM", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3122GI", g) == Game::ApplyResult::Ok);
+      std::deque<Move> moves;
+      g.generate(moves);
+      // 盤上の駒の移動 34 手と, 角打ち 43 マス
+      CHECK(moves.size() == 34 + 43);
+    }
+    SUBCASE("doMove/undoMove") {
+      Game g(Handicap::平手, false);
+      CHECK(MustMove("+7776FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+8822UM", g) == Game::ApplyResult::Ok);
+      std::deque<Move> moves;
+      g.generate(moves);
+      Position p = g.position;
+      Hand hb = g.handBlack;
+      Hand hw = g.handWhite;
+      for (Move const &mv : moves) {
+        auto undo = p.doMove(mv, hb, hw);
+        CHECK(p.hash != g.position.hash);
+        p.undoMove(mv, undo, hb, hw);
+        CHECK(p == g.position);
+        CHECK(p.hash == g.position.hash);
+        CHECK(p.all() == g.position.all());
+        CHECK(hb == g.handBlack);
+        CHECK(hw == g.handWhite);
+      }
+    }
+    SUBCASE("種類別") {
+      // 祭りの局面
+      auto sp = SfenPositionFromString("l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1");
+      REQUIRE(sp);
+      MoveList all;
+      Game::Generate(sp->position, sp->next, sp->handBlack, sp->handWhite, all, true);
+      size_t captures = 0;
+      size_t checks = 0;
+      for (Move const &mv : all) {
+        if (mv.captured) {
+          captures++;
+        }
+        Position p = sp->position;
+        Hand hb = sp->handBlack;
+        Hand hw = sp->handWhite;
+        REQUIRE(p.apply(mv, hb, hw));
+        if (p.isInCheck(OpponentColor(sp->next))) {
+          checks++;
+        }
+      }
+      MoveList moves;
+      Game::GenerateCaptures(sp->position, sp->next, moves);
+      CHECK(moves.size() == captures);
+      for (Move const &mv : moves) {
+        CHECK(mv.captured);
+      }
+      Game::GenerateChecks(sp->position, sp->next, sp->handBlack, sp->handWhite, moves, true);
+      CHECK(moves.size() == checks);
+      // 王手は掛かっていない
+      Game::GenerateEvasions(sp->position, sp->next, sp->handBlack, sp->handWhite, moves, true);
+      CHECK(moves.empty());
+    }
+    SUBCASE("王手回避") {
+      auto packed = [](MoveList const &moves) {
+        std::vector<uint32_t> ret;
+        for (Move const &mv : moves) {
+          ret.push_back(PackedMoveFromMove(mv).value);
+        }
+        std::sort(ret.begin(), ret.end());
+        return ret;
+      };
+      auto check = [&packed](std::string const &sfen) {
+        auto sp = SfenPositionFromString(sfen);
+        REQUIRE(sp);
+        REQUIRE(sp->position.isInCheck(sp->next));
+        MoveList all;
+        Game::Generate(sp->position, sp->next, sp->handBlack, sp->handWhite, all, true);
+        MoveList moves;
+        Game::GenerateEvasions(sp->position, sp->next, sp->handBlack, sp->handWhite, moves, true);
+        CHECK(!moves.empty());
+        CHECK(packed(moves) == packed(all));
+        return moves;
+      };
+      // 飛車の王手. 玉が逃げる手と, 金を打って合駒する手
+      auto moves = check("k3r4/9/9/9/9/9/9/9/4K4 b G 1");
+      CHECK(moves.size() == 11);
+      CHECK(std::count_if(moves.begin(), moves.end(), [](Move const &mv) { return !mv.from; }) == 7);
+      // 飛車と角の両王手. 玉を動かす手しかない
+      moves = check("k3r4/9/9/9/8b/9/9/9/3GK4 b G 1");
+      for (Move const &mv : moves) {
+        CHECK(PieceTypeFromPiece(mv.piece) == PieceType::King);
+      }
+      // 桂の王手. 王手している駒を取る手と, 玉が逃げる手. 合駒はできない
+      check("k8/9/9/9/9/9/3n5/2S1P4/3GK4 b - 1");
+    }
+  }
+  SUBCASE("hash") {
+    SUBCASE("差分更新") {
+      Game g(Handicap::平手, false);
+      CHECK(MustMove("+7776FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+8822UM", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3122GI", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+0055KA", g) == Game::ApplyResult::Ok);
+      Position p = g.position;
+      p.sync(g.handBlack, g.handWhite, g.next());
+      CHECK(p.hash == g.position.hash);
+    }
+    SUBCASE("手順前後") {
+      Game a(Handicap::平手, false);
+      CHECK(MustMove("+7776FU", a) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", a) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+2726FU", a) == Game::ApplyResult::Ok);
+      Game b(Handicap::平手, false);
+      CHECK(MustMove("+2726FU", b) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", b) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+7776FU", b) == Game::ApplyResult::Ok);
+      CHECK(a.position.hash == b.position.hash);
+      Position p = a.position;
+      p.sync(a.handBlack, a.handWhite, Color::Black);
+      // 手番が違う
+      CHECK(p.hash != a.position.hash);
+    }
+  }
+  SUBCASE("attackMap") {
+    Game g(Handicap::平手, false);
+    g.position.enableAttackMap();
+    CHECK(MustMove("+7776FU", g) == Game::ApplyResult::Ok);
+    CHECK(MustMove("-3334FU", g) == Game::ApplyResult::Ok);
+    CHECK(MustMove("+8822UM", g) == Game::ApplyResult::Ok);
+    CHECK(MustMove("-3122GI", g) == Game::ApplyResult::Ok);
+    CHECK(MustMove("+0055KA", g) == Game::ApplyResult::Ok);
+    auto check = [](Position const &p) {
+      for (int i = 0; i < 81; i++) {
+        for (Color c : {Color::Black, Color::White}) {
+          CHECK(p.attackers(i, c) == p.attackers(i, c, p.all()));
+        }
+      }
+    };
+    check(g.position);
+    std::deque<Move> moves;
+    g.generate(moves);
+    Position p = g.position;
+    Hand hb = g.handBlack;
+    Hand hw = g.handWhite;
+    for (Move const &mv : moves) {
+      auto undo = p.doMove(mv, hb, hw);
+      check(p);
+      p.undoMove(mv, undo, hb, hw);
+    }
+    check(p);
+    // ５五の角は２二の銀と９九の香に利いている
+    CHECK(g.position.attackers(IndexFromSquare(MakeSquare(File::File2, Rank::Rank2)), Color::Black).test(IndexFromSquare(MakeSquare(File::File5, Rank::Rank5))));
+    CHECK(g.position.attackers(IndexFromSquare(MakeSquare(File::File9, Rank::Rank9)), Color::Black).test(IndexFromSquare(MakeSquare(File::File5, Rank::Rank5))));
+  }
+  SUBCASE("startPosition") {
+    // コンパイル時に計算した値が sync() で計算したものと一致する
+    for (int i = 0; i <= static_cast<int>(Handicap::青空将棋); i++) {
+      Position p = MakePosition(static_cast<Handicap>(i));
+      Position q = p;
+      q.sync();
+      CHECK(p.hash == q.hash);
+      CHECK(p.occupied[0] == q.occupied[0]);
+      CHECK(p.occupied[1] == q.occupied[1]);
+      for (int t = 0; t < 9; t++) {
+        CHECK(p.types[t] == q.types[t]);
+      }
+      CHECK(p.promoted == q.promoted);
+      CHECK(p.kingSquare[0] == q.kingSquare[0]);
+      CHECK(p.kingSquare[1] == q.kingSquare[1]);
+    }
+    // 盤面を SFEN で書いたものと比べる. 平手以外は上手 (後手) から指す.
+    std::pair<Handicap, std::string> const layouts[] = {
+        {Handicap::平手, "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1"},
+        {Handicap::香落ち, "lnsgkgsn1/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::右香落ち, "1nsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::角落ち, "lnsgkgsnl/1r7/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::飛車落ち, "lnsgkgsnl/7b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::飛香落ち, "lnsgkgsn1/7b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::二枚落ち, "lnsgkgsnl/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::三枚落ち, "lnsgkgsn1/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::四枚落ち, "1nsgkgsn1/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::五枚落ち左桂, "1nsgkgs2/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::五枚落ち右桂, "2sgkgsn1/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::六枚落ち, "2sgkgs2/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::七枚落ち左銀, "2sgkg3/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::七枚落ち右銀, "3gkgs2/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::八枚落ち, "3gkg3/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::トンボ, "4k4/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::九枚落ち左金, "3gk4/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::九枚落ち右金, "4kg3/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::十枚落ち, "4k4/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1"},
+        {Handicap::青空将棋, "lnsgkgsnl/1r5b1/9/9/9/9/9/1B5R1/LNSGKGSNL w - 1"},
+    };
+    REQUIRE(std::size(layouts) == kHandicapPositions.size());
+    for (auto const &[h, sfen] : layouts) {
+      Game g(h, false);
+      CHECK(SfenStringFromPosition(g.position, g.handBlack, g.handWhite, g.first) == sfen);
+      auto expected = SfenPositionFromString(sfen);
+      REQUIRE(expected);
+      CHECK(g.position.hash == expected->position.hash);
+    }
+    // 駒渡しの場合は, 落とした駒を下手 (先手) の持ち駒にしたハッシュ値になる
+    auto expected = SfenPositionFromString("lnsgkgsnl/9/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w RB 1");
+    REQUIRE(expected);
+    CHECK(Game(Handicap::二枚落ち, true).position.hash == expected->position.hash);
+
+    Hand hand;
+    MakePosition(Handicap::二枚落ち, &hand);
+    CHECK(hand.size() == 2);
+    CHECK(hand.count(PieceType::Rook) == 1);
+    CHECK(hand.count(PieceType::Bishop) == 1);
+  }
+  SUBCASE("legalMoveSet") {
+    Game g(Handicap::平手, false);
+    LegalMoveSet set;
+    set.reset(g.position, Color::Black, g.handBlack, g.handWhite);
+    CHECK(set.size() == 30);
+    CHECK(set.contains(MakeSquare(File::File7, Rank::Rank7), MakeSquare(File::File7, Rank::Rank6), false));
+    CHECK(!set.contains(MakeSquare(File::File7, Rank::Rank7), MakeSquare(File::File7, Rank::Rank6), true));
+    CHECK(!set.contains(MakeSquare(File::File7, Rank::Rank7), MakeSquare(File::File7, Rank::Rank5), false));
+    CHECK(!set.contains(MakeSquare(File::File8, Rank::Rank8), MakeSquare(File::File2, Rank::Rank2), false));
+
+    auto sp = SfenPositionFromString("k8/2G6/9/1N7/9/9/9/9/9 b P2r2b3g4s3n4l17p 1");
+    REQUIRE(sp);
+    set.reset(sp->position, sp->next, sp->handBlack, sp->handWhite);
+    MoveList moves;
+    Game::Generate(sp->position, sp->next, sp->handBlack, sp->handWhite, moves, true);
+    CHECK(set.size() == moves.size());
+    for (Move const &mv : moves) {
+      CHECK(set.contains(mv));
+    }
+    // ２段目に跳ねる桂は成る手しか無い
+    CHECK(set.contains(MakeSquare(File::File8, Rank::Rank4), MakeSquare(File::File9, Rank::Rank2), true));
+    CHECK(!set.contains(MakeSquare(File::File8, Rank::Rank4), MakeSquare(File::File9, Rank::Rank2), false));
+    // ７二は自分の金が居るので跳ねられない
+    CHECK(!set.contains(MakeSquare(File::File8, Rank::Rank4), MakeSquare(File::File7, Rank::Rank2), true));
+    // 打ち歩詰めの歩は含まない
+    CHECK(!set.containsDrop(PieceType::Pawn, MakeSquare(File::File9, Rank::Rank2)));
+    CHECK(set.containsDrop(PieceType::Pawn, MakeSquare(File::File5, Rank::Rank5)));
+    CHECK(!set.containsDrop(PieceType::Gold, MakeSquare(File::File5, Rank::Rank5)));
+  }
+  SUBCASE("replay") {
+    auto kifu = [](std::initializer_list<char const *> csa) {
+      ReplayGame r;
+      Game g(r.handicap, r.handicapHand);
+      for (char const *m : csa) {
+        auto mv = MoveFromCsaMove(m, g.position);
+        REQUIRE(std::holds_alternative<Move>(mv));
+        r.moves.push_back(PackedMoveFromMove(std::get<Move>(mv)));
+        g.apply(std::get<Move>(mv));
+        g.moves.push_back(r.moves.back());
+      }
+      return r;
+    };
+    std::vector<ReplayGame> games;
+    games.push_back(kifu({"+7776FU", "-3334FU", "+8822UM", "-3122GI"}));
+    // 二歩
+    games.push_back(kifu({"+9796FU", "-9192KY", "+8897KA", "-1112KY", "+9753UM", "-7172GI", "+0056FU", "-4132KI"}));
+    games.push_back(kifu({"+2838HI", "-8272HI", "+3828HI", "-7282HI", "+2838HI", "-8272HI", "+3828HI", "-7282HI", "+2838HI", "-8272HI", "+3828HI", "-7282HI"}));
+    for (unsigned threads : {1u, 2u}) {
+      auto results = ReplayGames(games, threads);
+      REQUIRE(results.size() == 3);
+      CHECK(results[0].result == Game::ApplyResult::Ok);
+      CHECK(results[0].ply == 4);
+      CHECK(results[1].result == Game::ApplyResult::Illegal);
+      CHECK(results[1].ply == 7);
+      CHECK(results[2].result == Game::ApplyResult::Repetition);
+      CHECK(results[2].ply == 12);
+    }
+  }
+  SUBCASE("snapshot") {
+    // コピーした Game は中身を共有しているが, 片方を進めてももう片方は変わらない
+    Game g(Handicap::平手, false);
+    g.position.enableAttackMap();
+    auto round = [](Game &g) {
+      CHECK(MustMove("+2838HI", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-8272HI", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+3828HI", g) == Game::ApplyResult::Ok);
+      return MustMove("-7282HI", g);
+    };
+    CHECK(round(g) == Game::ApplyResult::Ok);
+    Game snapshot = g;
+    CHECK(round(g) == Game::ApplyResult::Ok);
+    CHECK(round(g) == Game::ApplyResult::Repetition);
+    CHECK(g.moves.size() == 12);
+    REQUIRE(snapshot.moves.size() == 4);
+    CHECK(MoveFromPackedMove(snapshot.moves.back()) == MoveFromPackedMove(g.moves[3]));
+    for (int i = 0; i < 81; i++) {
+      for (Color c : {Color::Black, Color::White}) {
+        CHECK(snapshot.position.attackers(i, c) == snapshot.position.attackers(i, c, snapshot.position.all()));
+      }
+    }
+    CHECK(round(snapshot) == Game::ApplyResult::Ok);
+    CHECK(round(snapshot) == Game::ApplyResult::Repetition);
+  }
+  SUBCASE("sfen") {
+    SUBCASE("平手") {
+      Game g(Handicap::平手, false);
+      CHECK(SfenStringFromPosition(g.position, g.handBlack, g.handWhite, g.next()) == "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1");
+    }
+    SUBCASE("局面") {
+      std::string sfen = "l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1";
+      auto p = SfenPositionFromString(sfen);
+      REQUIRE(p);
+      CHECK(p->next == Color::White);
+      CHECK(p->handWhite.count(PieceType::Pawn) == 5);
+      CHECK(p->position.pieces[File::File4][Rank::Rank2] == MakePiece(Color::Black, PieceType::Pawn, PieceStatus::Promoted));
+      CHECK(SfenStringFromPosition(p->position, p->handBlack, p->handWhite, p->next, p->ply) == sfen);
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSN b - 1"));
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL x - 1"));
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSG+KGSNL b - 1"));
+      // 駒の枚数が 1 組の駒より多い
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b P 1"));
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5RR/LNSGKGSNL b - 1"));
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b r 1"));
+      // 玉の枚数
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKKSNL b - 1"));
+      CHECK(!SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSG1GSNL w - 1"));
+      CHECK(!SfenPositionFromString("k8/9/9/9/9/9/9/9/K3K4 w - 1"));
+      // 詰将棋のように手番側の玉が無い局面は読める
+      CHECK(SfenPositionFromString("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSG1GSNL b - 1"));
+    }
+    SUBCASE("棋譜") {
+      Game g(Handicap::平手, false);
+      CHECK(MustMove("+7776FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3334FU", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+8822UM", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("-3122GI", g) == Game::ApplyResult::Ok);
+      CHECK(MustMove("+0055KA", g) == Game::ApplyResult::Ok);
+      std::string sfen = SfenStringFromGame(g);
+      CHECK(sfen == "sfen lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1 moves 7g7f 3c3d 8h2b+ 3a2b B*5e");
+      auto h = GameFromSfenString("position startpos moves 7g7f 3c3d 8h2b+ 3a2b B*5e");
+      REQUIRE(h);
+      CHECK(h->position.hash == g.position.hash);
+      CHECK(h->handWhite == g.handWhite);
+      REQUIRE(h->moves.size() == g.moves.size());
+      for (size_t i = 0; i < g.moves.size(); i++) {
+        CHECK(MoveFromPackedMove(h->moves[i]) == MoveFromPackedMove(g.moves[i]));
+      }
+      CHECK(SfenStringFromGame(*h) == sfen);
+      CHECK(!GameFromSfenString("startpos moves 7g7f 7g7f"));
+    }
+  }
 }
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+
+static std::u8string ReadKifuFile(std::filesystem::path const &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  return std::u8string((char8_t const *)s.c_str(), s.size());
+}
+
+TEST_CASE("kifu") {
+  Game g(Handicap::平手, false);
+  std::vector<Move> moves;
+  for (auto csa : {"+7776FU", "-3334FU", "+8822UM", "-3122GI", "+0055KA"}) {
+    auto mv = MoveFromCsaMove(csa, g.position);
+    REQUIRE(std::holds_alternative<Move>(mv));
+    Move m = std::get<Move>(mv);
+    m.decideSuffix(g.position);
+    REQUIRE(g.apply(m) == Game::ApplyResult::Ok);
+    g.moves.push_back(PackedMoveFromMove(m));
+    moves.push_back(m);
+  }
+  KifuHeader header;
+  header.startDateTime = u8"2024/01/02 03:04:05";
+  header.black = u8"先手の人";
+  header.white = u8"後手の人";
+  Status::Result resign;
+  resign.result = GameResult::BlackWin;
+  resign.reason = GameResultReason::Resign;
+
+  SUBCASE("KIF") {
+    CHECK(KifStringFromMove(moves[0], std::nullopt) == u8"７六歩(77)");
+    CHECK(KifStringFromMove(moves[2], moves[1].to) == u8"２二角成(88)");
+    CHECK(KifStringFromMove(moves[3], moves[2].to) == u8"同銀(31)");
+    CHECK(KifStringFromMove(moves[4], moves[3].to) == u8"５五角打");
+    CHECK(KifuStringFromGame(g, header, resign, KifuFormat::Kif) ==
+          u8"開始日時：2024/01/02 03:04:05\r\n"
+          u8"手合割：平手\r\n"
+          u8"先手：先手の人\r\n"
+          u8"後手：後手の人\r\n"
+          u8"手数----指手---------消費時間--\r\n"
+          u8"1 ７六歩(77)\r\n"
+          u8"2 ３四歩(33)\r\n"
+          u8"3 ２二角成(88)\r\n"
+          u8"4 同銀(31)\r\n"
+          u8"5 ５五角打\r\n"
+          u8"6 投了\r\n"
+          u8"まで5手で先手の勝ち\r\n");
+  }
+  SUBCASE("KI2") {
+    CHECK(Ki2StringFromMove(moves[1], moves[0].to) == u8"△３四歩");
+    CHECK(Ki2StringFromMove(moves[3], moves[2].to) == u8"△同銀");
+    // 盤上に角が無いので "打" は付けない
+    CHECK(Ki2StringFromMove(moves[4], moves[3].to) == u8"▲５五角");
+    Move mv;
+    mv.color = Color::White;
+    mv.piece = MakePiece(Color::White, PieceType::Silver);
+    mv.from = MakeSquare(File::File3, Rank::Rank3);
+    mv.to = MakeSquare(File::File2, Rank::Rank4);
+    mv.promote = -1;
+    mv.suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(SuffixType::Up);
+    CHECK(Ki2StringFromMove(mv, std::nullopt) == u8"△２四銀左上不成");
+    auto s = KifuStringFromGame(g, header, resign, KifuFormat::Ki2);
+    CHECK(s.ends_with(u8"後手：後手の人\r\n▲７六歩\r\n△３四歩\r\n▲２二角成\r\n△同銀\r\n▲５五角\r\nまで5手で先手の勝ち\r\n"));
+  }
+  SUBCASE("KifuWriter") {
+    auto path = std::filesystem::temp_directory_path() / "shogi_camera_kifu_test.kif";
+    {
+      KifuWriter writer(KifuFormat::Kif);
+      REQUIRE(writer.open(path.string(), header));
+      for (size_t i = 0; i < 3; i++) {
+        CHECK(writer.append(moves[i]));
+      }
+      // 終局前でも, 書き足した手はファイルに残っている
+      CHECK(ReadKifuFile(path).ends_with(u8"3 ２二角成(88)\r\n"));
+      for (size_t i = 3; i < moves.size(); i++) {
+        CHECK(writer.append(moves[i]));
+      }
+      CHECK(writer.ply() == moves.size());
+      CHECK(writer.finish(resign));
+      CHECK(!writer.isOpen());
+    }
+    CHECK(ReadKifuFile(path) == KifuStringFromGame(g, header, resign, KifuFormat::Kif));
+    std::filesystem::remove(path);
+  }
+  SUBCASE("ParseKifu") {
+    auto parse = [](std::u8string_view text) {
+      std::vector<KifuRecord> records;
+      ParseKifu(text, [&records](KifuRecord &&r) { records.push_back(std::move(r)); });
+      return records;
+    };
+    // 成る手の駒の表し方は MoveFromCsaMove と異なるので, Move として比べる
+    auto same = [&g](std::vector<PackedMove> const &actual) {
+      if (actual.size() != g.moves.size()) {
+        return false;
+      }
+      for (size_t i = 0; i < actual.size(); i++) {
+        Move a = MoveFromPackedMove(actual[i]);
+        Move e = MoveFromPackedMove(g.moves[i]);
+        if (!(a == e) || a.captured != e.captured || a.suffix != e.suffix) {
+          return false;
+        }
+      }
+      return true;
+    };
+    for (auto format : {KifuFormat::Kif, KifuFormat::Ki2}) {
+      auto records = parse(KifuStringFromGame(g, header, resign, format));
+      REQUIRE(records.size() == 1);
+      CHECK(!records[0].error);
+      CHECK(records[0].game.handicap == Handicap::平手);
+      CHECK(same(records[0].game.moves));
+    }
+    // "/" で区切って複数局. 2 局目は香落ち
+    auto records = parse(u8"V2.2\nN+先手\nPI\n+\n+7776FU\nT1\n-3334FU\n+8822UM,T3\n-3122GI\n+0055KA\n%TORYO\n/\nPI11KY\n-\n-5142OU\n");
+    REQUIRE(records.size() == 2);
+    CHECK(!records[0].error);
+    CHECK(same(records[0].game.moves));
+    CHECK(!records[1].error);
+    CHECK(records[1].game.handicap == Handicap::香落ち);
+    CHECK(records[1].game.moves.size() == 1);
+
+    // 駒渡し
+    Game hand(Handicap::香落ち, true);
+    Move mv = std::get<Move>(MoveFromCsaMove("-5142OU", hand.position));
+    REQUIRE(hand.apply(mv) == Game::ApplyResult::Ok);
+    hand.moves.push_back(PackedMoveFromMove(mv));
+    KifuHeader handHeader = header;
+    handHeader.handicap = Handicap::香落ち;
+    handHeader.handicapHand = true;
+    records = parse(KifuStringFromGame(hand, handHeader, std::nullopt, KifuFormat::Kif));
+    REQUIRE(records.size() == 1);
+    CHECK(!records[0].error);
+    CHECK(records[0].game.handicap == Handicap::香落ち);
+    CHECK(records[0].game.handicapHand);
+    CHECK(records[0].game.moves.size() == 1);
+
+    // 読み取れなかった手の前までを返す
+    records = parse(u8"手数----指手---------消費時間--\n1 ７六歩(77)\n2 ７六歩(77)\n3 ２六歩(27)\n");
+    REQUIRE(records.size() == 1);
+    CHECK(records[0].error);
+    CHECK(records[0].line == 3);
+    CHECK(records[0].game.moves.size() == 1);
+  }
+}
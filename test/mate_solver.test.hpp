@@ -0,0 +1,55 @@
+TEST_CASE("MateSolver") {
+  MateSolver solver(size_t(1) << 16);
+  SUBCASE("頭金") {
+    auto p = SfenPositionFromString("4k4/9/4P4/9/9/9/9/9/9 b G2r2b3g4s4n4l17p 1");
+    REQUIRE(p);
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, 100000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::Mate);
+    REQUIRE(answer.moves.size() == 1);
+    CHECK(SfenStringFromMove(answer.moves[0]) == "G*5b");
+  }
+  SUBCASE("5手詰") {
+    auto p = SfenPositionFromString("9/8k/5+R3/9/9/9/9/9/9 b RS2b4g3s4n4l18p 1");
+    REQUIRE(p);
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, 100000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::Mate);
+    CHECK(answer.moves.size() == 5);
+  }
+  SUBCASE("打ち歩詰め") {
+    // 歩を打つと詰むが打ち歩詰めになる
+    auto p = SfenPositionFromString("k8/2G6/9/1N7/9/9/9/9/9 b P2r2b3g4s3n4l17p 1");
+    REQUIRE(p);
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, 100000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::NoMate);
+  }
+  SUBCASE("探索の上限") {
+    auto p = SfenPositionFromString("6kl1/6p2/3s5/9/4B4/3Gs4/9/9/9 b BGN2r2g2s3n3l17p 1");
+    REQUIRE(p);
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, 1000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::Unknown);
+    CHECK(answer.nodes <= 1000);
+  }
+  SUBCASE("攻め方の交代") {
+    // 先手が攻めて詰む局面の証明を, 後手が攻める探索で使ってはいけない
+    auto p = SfenPositionFromString("3lkl3/3p1p3/9/5s3/4K4/9/9/9/4L4 b - 1");
+    REQUIRE(p);
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, 100000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::Mate);
+    // ４三の銀を４四に上がると, 上の局面になる
+    auto q = SfenPositionFromString("3lkl3/3p1p3/5s3/9/4K4/9/9/9/4L4 w - 1");
+    REQUIRE(q);
+    answer = solver.solve(q->position, q->next, q->handBlack, q->handWhite, 100000, std::chrono::milliseconds(10000));
+    CHECK(answer.result == MateSolver::Result::NoMate);
+  }
+  SUBCASE("中断") {
+    auto p = SfenPositionFromString("6kl1/6p2/3s5/9/4B4/3Gs4/9/9/9 b BGN2r2g2s3n3l17p 1");
+    REQUIRE(p);
+    std::thread th([&solver]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      solver.stop();
+    });
+    auto answer = solver.solve(p->position, p->next, p->handBlack, p->handWhite, std::numeric_limits<uint64_t>::max(), std::chrono::milliseconds(60000));
+    th.join();
+    CHECK(answer.result == MateSolver::Result::Unknown);
+  }
+}
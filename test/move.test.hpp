@@ -19,6 +19,13 @@ static void CheckSuffixWhen(Position const &p, Move base, File fileFrom, Rank ra
     a++;
   }
   CHECK(mv.suffix == expected);
+  // 利きの表を使う場合も同じ結果になる
+  Position q = p;
+  q.sync();
+  q.enableAttackMap();
+  mv.suffix = 0;
+  mv.decideSuffix(q);
+  CHECK(mv.suffix == expected);
 }
 
 TEST_CASE("Move::decideSuffix") {
@@ -378,3 +385,80 @@ TEST_CASE("Move::decideSuffix") {
     }
   }
 }
+
+TEST_CASE("PackedMove") {
+  Position p = EmptyPosition();
+  Move drop;
+  drop.color = Color::White;
+  drop.piece = MakePiece(Color::White, PieceType::Knight);
+  drop.to = MakeSquare(File::File1, Rank::Rank9);
+  drop.decideSuffix(p);
+  Move capture;
+  capture.color = Color::Black;
+  capture.piece = MakePiece(Color::Black, PieceType::Bishop);
+  capture.from = MakeSquare(File::File9, Rank::Rank9);
+  capture.to = MakeSquare(File::File1, Rank::Rank1);
+  capture.promote = 1;
+  capture.captured = RemoveColorFromPiece(MakePiece(Color::White, PieceType::Rook, PieceStatus::Promoted));
+  capture.suffix = static_cast<SuffixUnderlyingType>(SuffixType::Left) | static_cast<SuffixUnderlyingType>(SuffixType::Up);
+  for (Move const &m : {drop, capture}) {
+    PackedMove packed = PackedMoveFromMove(m);
+    Move unpacked = MoveFromPackedMove(packed);
+    CHECK(unpacked == m);
+    CHECK(unpacked.piece == m.piece);
+    CHECK(unpacked.captured == m.captured);
+    CHECK(unpacked.suffix == m.suffix);
+    CHECK(PackedMoveFromMove(unpacked) == packed);
+  }
+  CHECK(!(PackedMoveFromMove(drop) == PackedMoveFromMove(capture)));
+}
+
+TEST_CASE("ParseSquare") {
+  std::u8string_view s = u8"７六歩(77)";
+  size_t offset = 0;
+  auto sq = ParseSquare(s, offset);
+  REQUIRE(sq);
+  CHECK(*sq == MakeSquare(File::File7, Rank::Rank6));
+  CHECK(ParsePieceTypeAndStatus(s, offset) == static_cast<PieceUnderlyingType>(PieceType::Pawn));
+  CHECK(s.substr(offset) == u8"(77)");
+  // 読み取れなければ offset は進めない
+  CHECK(!ParseSquare(s, offset));
+  CHECK(offset == s.size() - 4);
+
+  CHECK(SquareFromString(u8"1九") == MakeSquare(File::File1, Rank::Rank9));
+  CHECK(!SquareFromString(u8"十一"));
+  std::u8string piece = u8"成銀右";
+  CHECK(TrimPieceTypeAndStatusPartFromString(piece) == (static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)));
+  CHECK(piece == u8"右");
+  piece = u8"と金";
+  CHECK(TrimPieceTypeAndStatusPartFromString(piece) == (static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)));
+  CHECK(piece.empty());
+  piece = u8"成";
+  CHECK(!TrimPieceTypeAndStatusPartFromString(piece));
+  CHECK(piece == u8"成");
+}
+
+TEST_CASE("FormatMoveTo") {
+  Move mv;
+  mv.color = Color::White;
+  mv.piece = MakePiece(Color::White, PieceType::Silver);
+  mv.from = MakeSquare(File::File3, Rank::Rank3);
+  mv.to = MakeSquare(File::File2, Rank::Rank4);
+  mv.promote = -1;
+  // 固定長の配列に書き込む
+  char8_t buffer[MoveStringBuffer::kCapacity];
+  char8_t *end = FormatMoveTo(buffer, mv, nullptr);
+  CHECK(std::u8string_view(buffer, end - buffer) == u8"△２四銀不成(33)");
+  CHECK(StringFromMove(mv) == u8"△２四銀不成(33)");
+  Square last = mv.to;
+  CHECK(StringFromMove(mv, last) == u8"△同銀不成(33)");
+
+  MoveStringBuffer str;
+  mv.from = std::nullopt;
+  mv.promote = 0;
+  FormatMoveTo(std::back_inserter(str), mv, nullptr);
+  CHECK(str.view() == u8"△２四銀打");
+  CHECK(std::string(str.c_str()) == (char const *)u8"△２四銀打");
+  FormatSquareTo(std::back_inserter(str), MakeSquare(File::File9, Rank::Rank9));
+  CHECK(str.view() == u8"△２四銀打９九");
+}
@@ -0,0 +1,190 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace sci;
+
+namespace {
+
+struct Options {
+  size_t games = 3000;
+  size_t gamesPerFile = 100;
+  size_t maxPly = 200;
+  unsigned threads = 0;
+  uint32_t seed = 1;
+};
+
+// 合法手からランダムに選んで棋譜を作る. 指し手は decideSuffix 済み.
+vector<ReplayGame> MakeGames(Options const &options) {
+  mt19937 engine(options.seed);
+  vector<ReplayGame> games;
+  games.reserve(options.games);
+  MoveList moves;
+  for (size_t i = 0; i < options.games; i++) {
+    ReplayGame g;
+    g.handicap = i % 4 == 0 ? Handicap::香落ち : Handicap::平手;
+    Game game(g.handicap, false);
+    for (size_t ply = 0; ply < options.maxPly; ply++) {
+      game.generate(moves);
+      if (moves.empty()) {
+        break;
+      }
+      Move mv = moves[uniform_int_distribution<size_t>(0, moves.size() - 1)(engine)];
+      mv.decideSuffix(game.position);
+      if (game.apply(mv) != Game::ApplyResult::Ok) {
+        break;
+      }
+      g.moves.push_back(PackedMoveFromMove(mv));
+      game.moves.push_back(g.moves.back());
+    }
+    games.push_back(std::move(g));
+  }
+  return games;
+}
+
+string CsaStringFromMove(Move const &mv) {
+  string s = mv.color == Color::Black ? "+" : "-";
+  if (mv.from) {
+    s += to_string(9 - mv.from->file) + to_string(mv.from->rank + 1);
+  } else {
+    s += "00";
+  }
+  s += to_string(9 - mv.to.file) + to_string(mv.to.rank + 1);
+  return s + *CsaStringFromPiece(mv.piece, mv.promote);
+}
+
+string CsaStringFromGame(ReplayGame const &g) {
+  string s = "V2.2\n";
+  s += g.handicap == Handicap::香落ち ? "PI11KY\n-\n" : "PI\n+\n";
+  for (PackedMove packed : g.moves) {
+    s += CsaStringFromMove(MoveFromPackedMove(packed)) + "\nT1\n";
+  }
+  return s + "%TORYO\n";
+}
+
+// gamesPerFile 局ずつ 1 つのファイルにまとめて書き出す.
+vector<string> WriteFiles(filesystem::path const &dir, vector<ReplayGame> const &games, KifuFormat const *format, Options const &options) {
+  vector<string> paths;
+  Status::Result resign;
+  resign.result = GameResult::BlackWin;
+  resign.reason = GameResultReason::Resign;
+  for (size_t begin = 0; begin < games.size(); begin += options.gamesPerFile) {
+    auto path = dir / (to_string(paths.size()) + (format ? (*format == KifuFormat::Kif ? ".kif" : ".ki2") : ".csa"));
+    ofstream out(path, ios::binary);
+    for (size_t i = begin; i < min(begin + options.gamesPerFile, games.size()); i++) {
+      if (format) {
+        Game game(games[i].handicap, false);
+        for (PackedMove packed : games[i].moves) {
+          game.moves.push_back(packed);
+        }
+        KifuHeader header;
+        header.handicap = games[i].handicap;
+        auto s = KifuStringFromGame(game, header, resign, *format);
+        out.write((char const *)s.data(), s.size());
+      } else {
+        if (i > begin) {
+          out << "/\n";
+        }
+        out << CsaStringFromGame(games[i]);
+      }
+    }
+    paths.push_back(path.string());
+  }
+  return paths;
+}
+
+bool Verify(vector<vector<KifuRecord>> const &results, vector<ReplayGame> const &games) {
+  size_t i = 0;
+  for (auto const &records : results) {
+    for (auto const &r : records) {
+      if (i >= games.size() || r.error || r.game.handicap != games[i].handicap || r.game.moves.size() != games[i].moves.size()) {
+        return false;
+      }
+      for (size_t j = 0; j < r.game.moves.size(); j++) {
+        Move a = MoveFromPackedMove(r.game.moves[j]);
+        Move e = MoveFromPackedMove(games[i].moves[j]);
+        if (!(a == e) || a.captured != e.captured || a.suffix != e.suffix) {
+          return false;
+        }
+      }
+      i++;
+    }
+  }
+  return i == games.size();
+}
+
+void Usage(char const *program) {
+  cerr << "usage: " << program << " [--games N] [--games-per-file N] [--max-ply N] [--threads N] [--seed N]" << endl;
+  cerr << "         ランダムに作った棋譜を KIF, KI2, CSA 形式で書き出し, ParseKifuFiles で読み取って元の棋譜と照合する" << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+      options.games = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--games-per-file") == 0 && i + 1 < argc) {
+      options.gamesPerFile = max<size_t>(1, strtoull(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--max-ply") == 0 && i + 1 < argc) {
+      options.maxPly = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  auto games = MakeGames(options);
+  size_t totalMoves = 0;
+  for (auto const &g : games) {
+    totalMoves += g.moves.size();
+  }
+  auto dir = filesystem::temp_directory_path() / ("shogi_camera_kifu_parser_bench_" + to_string(getpid()));
+  filesystem::create_directories(dir);
+  cout << "games=" << games.size() << " moves=" << totalMoves << endl;
+
+  int failures = 0;
+  KifuFormat const kif = KifuFormat::Kif;
+  KifuFormat const ki2 = KifuFormat::Ki2;
+  for (auto [name, format] : {pair<char const *, KifuFormat const *>{"KIF", &kif}, {"KI2", &ki2}, {"CSA", nullptr}}) {
+    auto paths = WriteFiles(dir, games, format, options);
+    uintmax_t bytes = 0;
+    for (auto const &path : paths) {
+      bytes += filesystem::file_size(path);
+    }
+    vector<unsigned> threads = {1};
+    if (options.threads != 1) {
+      threads.push_back(options.threads);
+    }
+    for (unsigned t : threads) {
+      auto begin = chrono::steady_clock::now();
+      auto results = ParseKifuFiles(paths, t);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+      bool ok = Verify(results, games);
+      cout << name << " threads=" << (t == 0 ? thread::hardware_concurrency() : t)
+           << " files=" << paths.size()
+           << " time=" << seconds << "s"
+           << " MB/s=" << (seconds > 0 ? bytes / seconds / 1e6 : 0)
+           << " moves/s=" << (seconds > 0 ? uint64_t(totalMoves / seconds) : 0)
+           << (ok ? " ok" : " NG") << endl;
+      if (!ok) {
+        failures++;
+      }
+    }
+    for (auto const &path : paths) {
+      filesystem::remove(path);
+    }
+  }
+  filesystem::remove_all(dir);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+using namespace sci;
+
+namespace {
+
+// 詰将棋の問題. mate は詰みまでの手数で, 不詰の場合は 0. 7 手以下のものは全幅探索で最短手数であることを確かめてある.
+struct Problem {
+  char const *name;
+  char const *sfen;
+  int mate;
+};
+
+vector<Problem> const kProblems = {
+    {"1手詰 1", "7kS/4p1l2/6G2/4s3+S/9/9/9/9/9 b S2r2b3g4n3l17p 1", 1},
+    {"1手詰 2", "6kB1/9/9/4+B4/8l/9/9/9/9 b 2R4g4s4n3l18p 1", 1},
+    {"1手詰 3", "9/6+L1k/9/8S/4L4/9/9/9/9 b Rr2b4g3s4n2l18p 1", 1},
+    {"3手詰 1", "6L2/7kl/9/7B1/6+R2/9/9/9/9 b SNrb4g3s3n2l18p 1", 3},
+    {"3手詰 2", "6k2/8n/6S2/6sR1/4P4/9/9/9/9 b r2b4g2s3n4l17p 1", 3},
+    {"3手詰 3", "4s4/5s2k/9/6+RG1/5R3/9/9/9/9 b G2b2g2s4n4l18p 1", 3},
+    {"5手詰 1", "9/5+B2k/9/8B/9/9/9/9/9 b SN2r4g3s3n4l18p 1", 5},
+    {"5手詰 2", "8l/6k2/9/5+N1B1/7n1/9/9/9/9 b S2rb4g3s2n3l18p 1", 5},
+    {"5手詰 3", "9/8k/5+R3/9/9/9/9/9/9 b RS2b4g3s4n4l18p 1", 5},
+    {"7手詰 1", "9/7B1/7k1/5R3/4g3g/9/9/9/9 b RLb2g4s4n3l18p 1", 7},
+    {"7手詰 2", "5B2k/6Gl1/9/6g1G/9/9/9/9/9 b L2rbg4s4n2l18p 1", 7},
+    {"7手詰 3", "8k/9/4R4/9/6g2/9/9/9/9 b BSrb3g3s4n4l18p 1", 7},
+    {"9手詰", "9/6k1n/9/6g2/4+B4/9/9/9/9 b RBr3g4s3n4l18p 1", 9},
+    {"11手詰", "9/4n1kp1/9/6s2/7+PB/9/9/9/9 b 2Rb4g3s3n4l16p 1", 11},
+    {"19手詰", "6kl1/6p2/3s5/9/4B4/3Gs4/9/9/9 b BGN2r2g2s3n3l17p 1", 19},
+    {"不詰 1", "7l1/7p1/7k1/6PN1/4B4/9/9/9/9 b L2rb4g4s3n2l16p 1", 0},
+    {"不詰 2", "9/8l/6k2/6s2/7+PL/6+P2/9/9/9 b GS2r2b3g2s4n2l16p 1", 0},
+    {"不詰 3", "3n5/9/5sk2/3P4s/9/3Ll4/9/9/9 b RSr2b4gs3n2l17p 1", 0},
+};
+
+struct Options {
+  uint64_t maxNodes = 10000000;
+  chrono::milliseconds timeout{10000};
+  size_t tableSize = size_t(1) << 20;
+};
+
+// 詰み手順 moves を指した結果, 相手玉が詰んでいるかどうか.
+bool IsMateSequence(SfenPosition start, vector<Move> const &moves) {
+  Color color = start.next;
+  for (Move const &mv : moves) {
+    if (mv.color != color || !start.position.apply(mv, start.handBlack, start.handWhite)) {
+      return false;
+    }
+    color = OpponentColor(color);
+  }
+  if (color == start.next) {
+    return false;
+  }
+  MoveList replies;
+  Game::Generate(start.position, color, start.handBlack, start.handWhite, replies, true);
+  return replies.empty() && start.position.isInCheck(color);
+}
+
+struct Result {
+  MateSolver::Answer answer;
+  double seconds;
+};
+
+Result Run(MateSolver &solver, SfenPosition const &start, Options const &options) {
+  solver.clear();
+  auto begin = chrono::steady_clock::now();
+  auto answer = solver.solve(start.position, start.next, start.handBlack, start.handWhite, options.maxNodes, options.timeout);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  return {answer, seconds};
+}
+
+void Print(string const &name, Result const &r) {
+  uint64_t nps = r.seconds > 0 ? uint64_t(r.answer.nodes / r.seconds) : 0;
+  cout << name << " ";
+  switch (r.answer.result) {
+  case MateSolver::Result::Mate:
+    cout << r.answer.moves.size() << "手詰";
+    break;
+  case MateSolver::Result::NoMate:
+    cout << "不詰";
+    break;
+  case MateSolver::Result::Unknown:
+    cout << "不明";
+    break;
+  }
+  cout << " nodes=" << r.answer.nodes << " time=" << r.seconds << "s nps=" << nps;
+}
+
+// 組み込みの問題を解いて答えと照合する.
+int Verify(Options const &options) {
+  MateSolver solver(options.tableSize);
+  int failures = 0;
+  uint64_t totalNodes = 0;
+  double totalSeconds = 0;
+  for (auto const &problem : kProblems) {
+    auto start = SfenPositionFromString(problem.sfen);
+    if (!start) {
+      cout << problem.name << " SFEN を読み取れませんでした" << endl;
+      failures++;
+      continue;
+    }
+    Result r = Run(solver, *start, options);
+    Print(problem.name, r);
+    bool ok;
+    if (problem.mate > 0) {
+      // 最短手順を返すとは限らないので, 既知の手数より長くなければよしとする
+      ok = r.answer.result == MateSolver::Result::Mate && (int)r.answer.moves.size() <= problem.mate && IsMateSequence(*start, r.answer.moves);
+    } else {
+      ok = r.answer.result == MateSolver::Result::NoMate;
+    }
+    if (ok) {
+      cout << " ok" << endl;
+    } else {
+      cout << " NG" << endl;
+      failures++;
+    }
+    totalNodes += r.answer.nodes;
+    totalSeconds += r.seconds;
+  }
+  cout << "total nodes=" << totalNodes << " time=" << totalSeconds << "s nps=" << (totalSeconds > 0 ? uint64_t(totalNodes / totalSeconds) : 0) << endl;
+  if (failures > 0) {
+    cout << failures << " failure(s)" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// 1 行に 1 局面の SFEN を並べたファイルの問題を解く. 空行と # で始まる行は読み飛ばす.
+int Solve(char const *path, Options const &options) {
+  ifstream in(path);
+  if (!in) {
+    cerr << "cannot open: " << path << endl;
+    return EXIT_FAILURE;
+  }
+  MateSolver solver(options.tableSize);
+  int solved = 0;
+  int count = 0;
+  uint64_t totalNodes = 0;
+  double totalSeconds = 0;
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line.starts_with("#")) {
+      continue;
+    }
+    auto start = SfenPositionFromString(line);
+    if (!start) {
+      cerr << "invalid sfen: " << line << endl;
+      continue;
+    }
+    count++;
+    Result r = Run(solver, *start, options);
+    Print("#" + to_string(count), r);
+    cout << endl;
+    if (r.answer.result == MateSolver::Result::Mate && IsMateSequence(*start, r.answer.moves)) {
+      solved++;
+    }
+    totalNodes += r.answer.nodes;
+    totalSeconds += r.seconds;
+  }
+  cout << "solved " << solved << "/" << count << " total nodes=" << totalNodes << " time=" << totalSeconds << "s nps=" << (totalSeconds > 0 ? uint64_t(totalNodes / totalSeconds) : 0) << endl;
+  return EXIT_SUCCESS;
+}
+
+void Usage(char const *program) {
+  cerr << "usage: " << program << " [--nodes N] [--time MS] [--table N] [<file>]" << endl;
+  cerr << "         file を省略すると組み込みの問題を解いて答えと照合する" << endl;
+  cerr << "         file には 1 行に 1 局面ずつ SFEN を書く" << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  char const *file = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+      options.maxNodes = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+      options.timeout = chrono::milliseconds(atoll(argv[++i]));
+    } else if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+      options.tableSize = strtoull(argv[++i], nullptr, 10);
+    } else if (argv[i][0] != '-' && !file) {
+      file = argv[i];
+    } else {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (file) {
+    return Solve(file, options);
+  }
+  return Verify(options);
+}
@@ -0,0 +1,177 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace sci;
+
+namespace {
+
+struct Options {
+  size_t games = 200;
+  size_t maxPly = 200;
+  size_t iterations = 20;
+  uint32_t seed = 1;
+};
+
+// ランダムな対局の KI2 形式の指し手から, 手番の記号を除いたもの. "同" で始まる手は除く.
+vector<u8string> MakeCorpus(Options const &options) {
+  mt19937 engine(options.seed);
+  vector<u8string> corpus;
+  MoveList moves;
+  for (size_t i = 0; i < options.games; i++) {
+    Game game(Handicap::平手, false);
+    for (size_t ply = 0; ply < options.maxPly; ply++) {
+      game.generate(moves);
+      if (moves.empty()) {
+        break;
+      }
+      Move mv = moves[uniform_int_distribution<size_t>(0, moves.size() - 1)(engine)];
+      mv.decideSuffix(game.position);
+      u8string s = Ki2StringFromMove(mv, nullopt);
+      corpus.push_back(s.substr(u8string_view(u8"▲").size()));
+      if (game.apply(mv) != Game::ApplyResult::Ok) {
+        break;
+      }
+      game.moves.push_back(PackedMoveFromMove(mv));
+    }
+  }
+  return corpus;
+}
+
+// 照合用. std::map を順に starts_with で調べ, 読んだ分を substr で切り詰める以前の実装.
+optional<Square> ReferenceTrimSquare(u8string &inout) {
+  static map<u8string, int32_t> const sMap = {
+      {u8"一", 0}, {u8"１", 0}, {u8"1", 0}, {u8"二", 1}, {u8"２", 1}, {u8"2", 1}, {u8"三", 2}, {u8"３", 2}, {u8"3", 2}, {u8"四", 3}, {u8"４", 3}, {u8"4", 3}, {u8"五", 4}, {u8"５", 4}, {u8"5", 4}, {u8"六", 5}, {u8"６", 5}, {u8"6", 5}, {u8"七", 6}, {u8"７", 6}, {u8"7", 6}, {u8"八", 7}, {u8"８", 7}, {u8"8", 7}, {u8"九", 8}, {u8"９", 8}, {u8"9", 8}};
+  u8string s = inout;
+  optional<int32_t> f;
+  for (auto const &it : sMap) {
+    if (s.starts_with(it.first)) {
+      f = 8 - it.second;
+      s = s.substr(it.first.size());
+      break;
+    }
+  }
+  optional<int32_t> r;
+  for (auto const &it : sMap) {
+    if (f && s.starts_with(it.first)) {
+      r = it.second;
+      s = s.substr(it.first.size());
+      break;
+    }
+  }
+  if (!f || !r) {
+    return nullopt;
+  }
+  inout.swap(s);
+  return MakeSquare(*f, *r);
+}
+
+optional<PieceUnderlyingType> ReferenceTrimPiece(u8string &inout) {
+  static pair<u8string, PieceUnderlyingType> const kNames[] = {
+      {u8"玉", static_cast<PieceUnderlyingType>(PieceType::King)},
+      {u8"飛", static_cast<PieceUnderlyingType>(PieceType::Rook)},
+      {u8"角", static_cast<PieceUnderlyingType>(PieceType::Bishop)},
+      {u8"金", static_cast<PieceUnderlyingType>(PieceType::Gold)},
+      {u8"銀", static_cast<PieceUnderlyingType>(PieceType::Silver)},
+      {u8"桂", static_cast<PieceUnderlyingType>(PieceType::Knight)},
+      {u8"香", static_cast<PieceUnderlyingType>(PieceType::Lance)},
+      {u8"歩", static_cast<PieceUnderlyingType>(PieceType::Pawn)},
+      {u8"龍", static_cast<PieceUnderlyingType>(PieceType::Rook) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"馬", static_cast<PieceUnderlyingType>(PieceType::Bishop) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"成銀", static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"全", static_cast<PieceUnderlyingType>(PieceType::Silver) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"成桂", static_cast<PieceUnderlyingType>(PieceType::Knight) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"圭", static_cast<PieceUnderlyingType>(PieceType::Knight) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"成香", static_cast<PieceUnderlyingType>(PieceType::Lance) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"杏", static_cast<PieceUnderlyingType>(PieceType::Lance) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"と金", static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+      {u8"と", static_cast<PieceUnderlyingType>(PieceType::Pawn) | static_cast<PieceUnderlyingType>(PieceStatus::Promoted)},
+  };
+  for (auto const &[name, type] : kNames) {
+    if (inout.starts_with(name)) {
+      inout = inout.substr(name.size());
+      return type;
+    }
+  }
+  return nullopt;
+}
+
+// マスと駒を読み取った結果. 照合と, 最適化で処理が消えないようにするために使う.
+uint64_t Digest(optional<Square> sq, optional<PieceUnderlyingType> piece, size_t rest) {
+  uint64_t v = sq ? uint64_t(IndexFromSquare(*sq) + 1) : 0;
+  v = v * 64 + (piece ? *piece : 0);
+  return v * 64 + rest;
+}
+
+uint64_t RunReference(vector<u8string> const &corpus) {
+  uint64_t ret = 0;
+  for (auto const &m : corpus) {
+    u8string s = m;
+    auto sq = ReferenceTrimSquare(s);
+    auto piece = ReferenceTrimPiece(s);
+    ret = ret * 31 + Digest(sq, piece, s.size());
+  }
+  return ret;
+}
+
+uint64_t RunTable(vector<u8string> const &corpus) {
+  uint64_t ret = 0;
+  for (auto const &m : corpus) {
+    size_t offset = 0;
+    auto sq = ParseSquare(m, offset);
+    auto piece = ParsePieceTypeAndStatus(m, offset);
+    ret = ret * 31 + Digest(sq, piece, m.size() - offset);
+  }
+  return ret;
+}
+
+double Measure(uint64_t (*run)(vector<u8string> const &), vector<u8string> const &corpus, size_t iterations, uint64_t &digest) {
+  auto begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    digest = run(corpus);
+  }
+  return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+void Usage(char const *program) {
+  cerr << "usage: " << program << " [--games N] [--max-ply N] [--iterations N] [--seed N]" << endl;
+  cerr << "         KI2 形式の指し手からマスと駒を読み取る速さを, 以前の実装と比べる" << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+      options.games = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-ply") == 0 && i + 1 < argc) {
+      options.maxPly = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      options.iterations = max<size_t>(1, strtoull(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  auto corpus = MakeCorpus(options);
+  // "と金" と "成銀" の 2 文字の表記も混ぜる
+  corpus.push_back(u8"２三と金");
+  corpus.push_back(u8"５五成銀左");
+  corpus.push_back(u8"7六歩");
+  cout << "moves=" << corpus.size() << endl;
+
+  uint64_t expected = 0;
+  uint64_t actual = 0;
+  double reference = Measure(RunReference, corpus, options.iterations, expected);
+  double table = Measure(RunTable, corpus, options.iterations, actual);
+  size_t n = corpus.size() * options.iterations;
+  cout << "map   ns/move=" << reference / n * 1e9 << endl;
+  cout << "table ns/move=" << table / n * 1e9 << (expected == actual ? " ok" : " NG") << endl;
+  return expected == actual ? EXIT_SUCCESS : EXIT_FAILURE;
+}
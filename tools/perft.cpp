@@ -0,0 +1,203 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace sci;
+
+namespace {
+
+// 既知の葉の数. 平手と SFEN の局面は公開されている値と一致する. 駒落ちの値は平手と同じ生成器で数えたもの.
+struct KnownAnswer {
+  Handicap handicap;
+  vector<uint64_t> nodes; // [depth - 1]
+};
+
+struct KnownSfenAnswer {
+  char const *name;
+  char const *sfen;
+  vector<uint64_t> nodes; // [depth - 1]
+};
+
+vector<KnownAnswer> const kKnownAnswers = {
+    {Handicap::平手, {30, 900, 25470, 719731, 19861490}},
+    {Handicap::香落ち, {30, 900, 25530, 721433}},
+    {Handicap::右香落ち, {29, 870, 23790, 672187}},
+    {Handicap::角落ち, {33, 990, 29910, 846566}},
+    {Handicap::飛車落ち, {25, 750, 18570, 524461}},
+    {Handicap::飛香落ち, {25, 750, 18570, 524465}},
+    {Handicap::二枚落ち, {26, 780, 19740, 558731}},
+    {Handicap::三枚落ち, {25, 750, 18240, 516277}},
+    {Handicap::四枚落ち, {24, 720, 16800, 475521}},
+    {Handicap::五枚落ち左桂, {24, 720, 16770, 474672}},
+    {Handicap::五枚落ち右桂, {24, 720, 16770, 474672}},
+    {Handicap::六枚落ち, {24, 720, 16740, 473823}},
+    {Handicap::七枚落ち左銀, {22, 660, 14250, 403352}},
+    {Handicap::七枚落ち右銀, {22, 660, 14250, 403348}},
+    {Handicap::八枚落ち, {20, 600, 12000, 339669}},
+    {Handicap::トンボ, {23, 690, 15720, 443814}},
+    {Handicap::九枚落ち左金, {17, 510, 8760, 247965}},
+    {Handicap::九枚落ち右金, {17, 510, 8760, 247965}},
+    {Handicap::十枚落ち, {14, 420, 5880, 166449}},
+    {Handicap::青空将棋, {60, 3258, 193420, 10930389}},
+};
+
+vector<KnownSfenAnswer> const kKnownSfenAnswers = {
+    {"祭り", "l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1", {207, 28684, 4809015}},
+    {"最大合法手", "R8/2K1S1SSk/4B4/9/9/9/9/9/1L1L1L3 b RBGSNLP3g3n17p 1", {593}},
+};
+
+uint64_t Perft(Position const &position, Color color, Hand const &handBlack, Hand const &handWhite, int depth) {
+  MoveList moves;
+  Game::Generate(position, color, handBlack, handWhite, moves, true);
+  if (depth <= 1) {
+    return moves.size();
+  }
+  uint64_t nodes = 0;
+  for (Move const &mv : moves) {
+    Position p = position;
+    Hand black = handBlack;
+    Hand white = handWhite;
+    if (!p.apply(mv, black, white)) {
+      // 合法手として生成した手が適用できない. 生成器か apply のどちらかが間違っている
+      cerr << "apply failed: " << (char const *)StringFromMove(mv).c_str() << endl;
+      continue;
+    }
+    nodes += Perft(p, OpponentColor(color), black, white, depth - 1);
+  }
+  return nodes;
+}
+
+struct Result {
+  uint64_t nodes;
+  double seconds;
+};
+
+SfenPosition StartPosition(Handicap h) {
+  Game g(h, false);
+  SfenPosition ret;
+  ret.position = g.position;
+  ret.handBlack = g.handBlack;
+  ret.handWhite = g.handWhite;
+  ret.next = g.first;
+  return ret;
+}
+
+Result Run(SfenPosition const &start, int depth) {
+  auto begin = chrono::steady_clock::now();
+  uint64_t nodes = Perft(start.position, start.next, start.handBlack, start.handWhite, depth);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  return {nodes, seconds};
+}
+
+void Print(string const &name, int depth, Result const &r) {
+  uint64_t nps = r.seconds > 0 ? uint64_t(r.nodes / r.seconds) : 0;
+  cout << name << " depth=" << depth << " nodes=" << r.nodes << " time=" << r.seconds << "s nps=" << nps;
+}
+
+optional<Handicap> HandicapFromName(char const *name) {
+  for (auto const &answer : kKnownAnswers) {
+    if (strcmp((char const *)StringFromHandicap(answer.handicap).c_str(), name) == 0) {
+      return answer.handicap;
+    }
+  }
+  return nullopt;
+}
+
+// 既知の値と照合する. maxDepth より深いものは省略する.
+int Verify(int maxDepth) {
+  int failures = 0;
+  uint64_t totalNodes = 0;
+  double totalSeconds = 0;
+  auto verify = [&](string const &name, SfenPosition const &start, vector<uint64_t> const &nodes) {
+    for (int depth = 1; depth <= (int)nodes.size() && depth <= maxDepth; depth++) {
+      Result r = Run(start, depth);
+      uint64_t expected = nodes[depth - 1];
+      Print(name, depth, r);
+      if (r.nodes == expected) {
+        cout << " ok" << endl;
+      } else {
+        cout << " NG (expected " << expected << ")" << endl;
+        failures++;
+      }
+      totalNodes += r.nodes;
+      totalSeconds += r.seconds;
+    }
+  };
+  for (auto const &answer : kKnownAnswers) {
+    verify((char const *)StringFromHandicap(answer.handicap).c_str(), StartPosition(answer.handicap), answer.nodes);
+  }
+  for (auto const &answer : kKnownSfenAnswers) {
+    auto start = SfenPositionFromString(answer.sfen);
+    if (!start) {
+      cout << answer.name << " SFEN を読み取れませんでした" << endl;
+      failures++;
+      continue;
+    }
+    verify(answer.name, *start, answer.nodes);
+  }
+  cout << "total nodes=" << totalNodes << " time=" << totalSeconds << "s nps=" << (totalSeconds > 0 ? uint64_t(totalNodes / totalSeconds) : 0) << endl;
+  if (failures > 0) {
+    cout << failures << " failure(s)" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+void Usage(char const *program) {
+  cerr << "usage: " << program << " [--max-depth N]" << endl;
+  cerr << "         既知の値と照合する" << endl;
+  cerr << "       " << program << " <depth> [<handicap>]" << endl;
+  cerr << "         指定した局面から depth 手先までの葉の数を数える (既定は平手)" << endl;
+  cerr << "       " << program << " <depth> sfen <board> <turn> <hand> [<ply>]" << endl;
+  cerr << "         SFEN で指定した局面から depth 手先までの葉の数を数える" << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc == 1) {
+    return Verify(numeric_limits<int>::max());
+  }
+  if (argc == 3 && strcmp(argv[1], "--max-depth") == 0) {
+    return Verify(atoi(argv[2]));
+  }
+  int depth = atoi(argv[1]);
+  if (depth < 1) {
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (argc >= 3 && strcmp(argv[2], "sfen") == 0) {
+    string sfen;
+    for (int i = 3; i < argc; i++) {
+      sfen += argv[i];
+      sfen += ' ';
+    }
+    auto start = SfenPositionFromString(sfen);
+    if (!start) {
+      cerr << "invalid sfen: " << sfen << endl;
+      return EXIT_FAILURE;
+    }
+    Print("sfen", depth, Run(*start, depth));
+    cout << endl;
+    return EXIT_SUCCESS;
+  }
+  if (argc > 3) {
+    Usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  Handicap h = Handicap::平手;
+  if (argc == 3) {
+    auto handicap = HandicapFromName(argv[2]);
+    if (!handicap) {
+      cerr << "unknown handicap: " << argv[2] << endl;
+      return EXIT_FAILURE;
+    }
+    h = *handicap;
+  }
+  Print((char const *)StringFromHandicap(h).c_str(), depth, Run(StartPosition(h), depth));
+  cout << endl;
+  return EXIT_SUCCESS;
+}
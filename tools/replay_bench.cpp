@@ -0,0 +1,134 @@
+#include <shogi_camera/shogi_camera.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace sci;
+
+namespace {
+
+struct Options {
+  size_t games = 10000;
+  size_t maxPly = 256;
+  unsigned threads = 0;
+  uint32_t seed = 1;
+};
+
+// 合法手からランダムに選んで棋譜を作る. 一部の棋譜には, 最後に反則手 (二手指し) を付け加える.
+vector<ReplayGame> MakeGames(Options const &options) {
+  mt19937 engine(options.seed);
+  vector<ReplayGame> games;
+  games.reserve(options.games);
+  MoveList moves;
+  for (size_t i = 0; i < options.games; i++) {
+    ReplayGame g;
+    g.handicap = i % 4 == 0 ? Handicap::香落ち : Handicap::平手;
+    Game game(g.handicap, false);
+    for (size_t ply = 0; ply < options.maxPly; ply++) {
+      game.generate(moves);
+      if (moves.empty()) {
+        break;
+      }
+      Move mv = moves[uniform_int_distribution<size_t>(0, moves.size() - 1)(engine)];
+      g.moves.push_back(PackedMoveFromMove(mv));
+      if (game.apply(mv) != Game::ApplyResult::Ok) {
+        break;
+      }
+      game.moves.push_back(g.moves.back());
+    }
+    if (i % 10 == 9 && !g.moves.empty()) {
+      g.moves.push_back(g.moves.back());
+    }
+    games.push_back(std::move(g));
+  }
+  return games;
+}
+
+// ReplayGames を使わずに 1 局ずつ再生した結果.
+vector<ReplayResult> ReplaySequential(vector<ReplayGame> const &games) {
+  vector<ReplayResult> results;
+  results.reserve(games.size());
+  for (auto const &g : games) {
+    Game game(g.handicap, g.handicapHand);
+    ReplayResult r;
+    for (PackedMove const &packed : g.moves) {
+      r.ply++;
+      r.result = game.apply(MoveFromPackedMove(packed));
+      if (r.result != Game::ApplyResult::Ok) {
+        break;
+      }
+      game.moves.push_back(packed);
+    }
+    results.push_back(r);
+  }
+  return results;
+}
+
+double Measure(vector<ReplayGame> const &games, unsigned threads, vector<ReplayResult> &results) {
+  auto begin = chrono::steady_clock::now();
+  results = ReplayGames(games, threads);
+  return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+void Usage(char const *program) {
+  cerr << "usage: " << program << " [--games N] [--max-ply N] [--threads N] [--seed N]" << endl;
+  cerr << "         ランダムに作った棋譜を ReplayGames で再生し, 1 局ずつ再生した結果と照合する" << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+      options.games = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-ply") == 0 && i + 1 < argc) {
+      options.maxPly = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  auto games = MakeGames(options);
+  size_t totalMoves = 0;
+  for (auto const &g : games) {
+    totalMoves += g.moves.size();
+  }
+  auto expected = ReplaySequential(games);
+  size_t illegal = 0;
+  for (auto const &r : expected) {
+    if (r.result != Game::ApplyResult::Ok) {
+      illegal++;
+    }
+  }
+  cout << "games=" << games.size() << " moves=" << totalMoves << " not ok=" << illegal << endl;
+
+  int failures = 0;
+  vector<unsigned> threads = {1};
+  if (options.threads != 1) {
+    threads.push_back(options.threads);
+  }
+  for (unsigned t : threads) {
+    vector<ReplayResult> results;
+    double seconds = Measure(games, t, results);
+    bool ok = results.size() == expected.size();
+    for (size_t i = 0; ok && i < results.size(); i++) {
+      ok = results[i].result == expected[i].result && results[i].ply == expected[i].ply;
+    }
+    cout << "threads=" << (t == 0 ? thread::hardware_concurrency() : t)
+         << " time=" << seconds << "s"
+         << " games/s=" << (seconds > 0 ? uint64_t(games.size() / seconds) : 0)
+         << " moves/s=" << (seconds > 0 ? uint64_t(totalMoves / seconds) : 0)
+         << (ok ? " ok" : " NG") << endl;
+    if (!ok) {
+      failures++;
+    }
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}